@@ -0,0 +1,420 @@
+#include "encode.hpp"
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+/* Correctness and throughput of the encode.cpp primitives
+
+   ./encode_bench [--millis N] [--check]
+
+   Known answers and round-trips run first, a failure there ends with exit
+   code 1. Then GB/s per input size (8 B .. 1 MB), then hash quality:
+   avalanche and collisions on generated host names, since that's what the
+   pool hashes (low bits pick the HostTable slot and the shard).
+   --check stops after the correctness part.
+*/
+
+
+/*****************************************************************************/
+/* Known answers                                                             */
+/*****************************************************************************/
+    struct Base64Answer
+    {
+        const char *raw;
+        const char *encoded;
+    };
+
+    // RFC 4648, section 10:
+    static constexpr Base64Answer base64Answers[] =
+        { { "",       ""         }
+        , { "f",      "Zg=="     }
+        , { "fo",     "Zm8="     }
+        , { "foo",    "Zm9v"     }
+        , { "foob",   "Zm9vYg==" }
+        , { "fooba",  "Zm9vYmE=" }
+        , { "foobar", "Zm9vYmFy" }
+        , { "login:passwor", "bG9naW46cGFzc3dvcg==" }
+        };
+
+    struct HashAnswer
+    {
+        const char *key;
+        enc_u32     len;
+        enc_u64     simple;
+        enc_u64     fnv;
+    };
+
+    // No reference for these two, the values pin the current output so faster versions must match it:
+    static constexpr HashAnswer hashAnswers[] =
+        { { "",                                     0, 0xdeb049c4564fea34ull, 0xaf63bd4c8601b7dfull }
+        , { "a",                                    1, 0xdeb049c4ab2f9597ull, 0xaf63dc4c8601ec8cull }
+        , { "localhost",                            9, 0x465c08268690fd04ull, 0x7373e1b836acb7cdull }
+        , { "127.0.0.1:18080",                     15, 0x1d9d12da465f10d2ull, 0x84e80ee6879b4ea4ull }
+        , { "0123456789abcdef",                    16, 0xe9b82949ac1ac4c1ull, 0x807d151569cf7d2full }
+        , { "api.example.com:443",                 19, 0xa071419a3e6f3c9full, 0xf1a6b199cd9543e5ull }
+        , { "user@proxy.internal.example.org:1080", 36, 0x214a6549b8cba22dull, 0xebf9d2ca2cc8a732ull }
+        , { "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/", 64, 0x79241e5e85403cc9ull, 0xf6a691ed44cd72ccull }
+        , { "https-endpoint-with-a-rather-long-name.eu-west-1.compute.internal.example.com:8443/x/y/z/abcdefghij", 99, 0x35e8bf1abe25f3baull, 0xe3bb4e10b99764c4ull }
+        };
+
+    // FNV1a and simplehash_portable are constexpr, same answers at compile time:
+    static_assert([]
+                  {
+                      bool ok = true;
+                      for (const HashAnswer& a : hashAnswers)
+                          ok = ok && FNV1a(a.key, a.len) == a.fnv && simplehash_portable(a.key, a.len) == a.simple;
+                      return ok;
+                  }()
+                 );
+
+    static int failures = 0;
+
+    static void fail(const char *what, const std::string_view detail)
+    {
+        std::printf("FAIL %s: %.*s\n", what, (int)detail.size(), detail.data());
+        ++failures;
+    }
+
+    static void checkAnswers()
+    {
+        for (const Base64Answer& a : base64Answers)
+        {
+            const int rawLen = (int)std::strlen(a.raw);
+            const int encLen = (int)std::strlen(a.encoded);
+
+            std::string enc(base64encode_getRequiredSize(rawLen), '\0');
+            base64encode(enc.data(), a.raw, rawLen);
+            if (enc != a.encoded)
+                fail("base64encode", a.raw);
+
+            std::string dec(base64decode_getRequiredSize(encLen), '\0');
+            if (base64decode(dec.data(), a.encoded, encLen) != rawLen || std::string_view(dec.data(), rawLen) != a.raw)
+                fail("base64decode", a.encoded);
+        }
+
+        for (const char *bad : { "Zm9v!A==", "Zm9", "Zm\x80v", "Zm 9", "Z===", "Zm=v", "Zm9vYmFyYmF6YmF6Zm9vYmFy!mF6YmF6Zm9vYmFyYmF6YmF6Zm9vYmFyYmF6YmF6Zm9vYmFyYmF6" })
+        {
+            char dst[64];
+            if (base64decode(dst, bad, (int)std::strlen(bad)) != -1)
+                fail("base64decode accepted", bad);
+        }
+
+        for (const HashAnswer& a : hashAnswers)
+        {
+            if (simplehash(a.key, a.len) != a.simple)
+                fail("simplehash", a.key);
+            if (FNV1a(a.key, a.len) != a.fnv)
+                fail("FNV1a", a.key);
+        }
+    }
+
+
+/*****************************************************************************/
+/* Round-trips                                                               */
+/*****************************************************************************/
+    static constexpr char canary = '\x5a';
+
+    static void roundTrip(const std::string& raw)
+    {
+        const int rawLen = (int)raw.size();
+        const int encLen = base64encode_getRequiredSize(rawLen);
+
+        // One canary byte past the end, neither side may touch it:
+        std::string enc(encLen + 1, canary);
+        base64encode(enc.data(), raw.data(), rawLen);
+        if (enc[encLen] != canary)
+            fail("base64encode wrote past the end", std::to_string(rawLen));
+
+        std::string dec(base64decode_getRequiredSize(encLen) + 1, canary);
+        const int decLen = base64decode(dec.data(), enc.data(), encLen);
+        if (decLen != rawLen || dec.back() != canary || std::string_view(dec.data(), rawLen) != raw)
+            fail("base64 round-trip", std::to_string(rawLen));
+
+        // One bad character anywhere, every kernel width has to notice:
+        if (encLen >= 8)
+        {
+            const int at = (int)(((unsigned)rawLen * 2654435761u) % (unsigned)(encLen - 4));
+            const char saved = enc[at];
+            enc[at] = "!.:@[`{\x80"[rawLen % 8];
+            if (base64decode(dec.data(), enc.data(), encLen) != -1)
+                fail("base64decode accepted a bad character", std::to_string(rawLen));
+            enc[at] = saved;
+        }
+    }
+
+    static void checkRoundTrips()
+    {
+        std::mt19937_64 rng(1);
+
+        // Every tail length, every byte value in every position:
+        for (int len=0; len<=256; ++len)
+        {
+            std::string raw(len, '\0');
+            for (int i=0; i<len; ++i)
+                raw[i] = (char)(i*7 + len);
+            roundTrip(raw);
+        }
+        for (int len=4096; len<4096+64; ++len)
+        {
+            std::string raw(len, '\0');
+            for (char& c : raw)
+                c = (char)rng();
+            roundTrip(raw);
+        }
+        for (int i=0; i<2000; ++i)
+        {
+            std::string raw(rng() % 1024, '\0');
+            for (char& c : raw)
+                c = (char)rng();
+            roundTrip(raw);
+        }
+
+        // The hashes must not read past len:
+        for (enc_u32 len=0; len<=200; ++len)
+        {
+            std::vector<char> key(len + 32);
+            for (char& c : key)
+                c = (char)rng();
+            const enc_u64 s = simplehash(key.data(), len), f = FNV1a(key.data(), len);
+            if (simplehash_portable(key.data(), len) != s)
+                fail("simplehash and simplehash_portable differ", std::to_string(len));
+            for (enc_u32 i=len; i<key.size(); ++i)
+                key[i] = ~key[i];
+            if (simplehash(key.data(), len) != s || FNV1a(key.data(), len) != f)
+                fail("hash depends on bytes past len", std::to_string(len));
+        }
+    }
+
+
+/*****************************************************************************/
+/* Throughput                                                                */
+/*****************************************************************************/
+    static volatile enc_u64 sink;
+
+    // GB/s of raw input, repeated until at least millis went by:
+    template <typename Op>
+    static double measure(const size_t bytes, const int millis, Op op)
+    {
+        const Clock::duration budget = std::chrono::milliseconds(millis);
+        long long rounds = 0;
+        long long batch = std::max<long long>(1, (1 << 16) / (long long)bytes);
+        const Clock::time_point t0 = Clock::now();
+        Clock::duration elapsed{};
+        while (elapsed < budget)
+        {
+            for (long long i=0; i<batch; ++i)
+                op(i);
+            rounds += batch;
+            elapsed = Clock::now() - t0;
+            batch *= 2;
+        }
+        return (double)rounds * (double)bytes / std::chrono::duration<double>(elapsed).count() / 1e9;
+    }
+
+    static void throughput(const int millis)
+    {
+        std::printf("\n%-8s %12s %12s %12s %12s %12s   (GB/s of raw input)\n", "size", "simplehash", "portable", "FNV1a", "b64encode", "b64decode");
+
+        std::mt19937_64 rng(2);
+        for (size_t size = 8; size <= (1 << 20); size *= 2)
+        {
+            // Some slack so consecutive rounds start at different offsets:
+            std::vector<char> raw(size + 64);
+            for (char& c : raw)
+                c = (char)rng();
+            std::vector<char> enc(base64encode_getRequiredSize(size + 64));
+            std::vector<char> dec(base64decode_getRequiredSize(enc.size()));
+            base64encode(enc.data(), raw.data(), size);
+
+            const double simple = measure(size, millis, [&](long long i){ sink = simplehash(raw.data() + (i & 63), (enc_u32)size); });
+            const double soft   = measure(size, millis, [&](long long i){ sink = simplehash_portable(raw.data() + (i & 63), (enc_u32)size); });
+            const double fnv    = measure(size, millis, [&](long long i){ sink = FNV1a(raw.data() + (i & 63), size); });
+            const double encode = measure(size, millis, [&](long long i){ base64encode(enc.data(), raw.data() + (i & 63), size); sink = enc[0]; });
+            base64encode(enc.data(), raw.data(), size);
+            const double decode = measure(size, millis, [&](long long  ){ base64decode(dec.data(), enc.data(), base64encode_getRequiredSize(size)); sink = dec[0]; });
+
+            char label[32];
+            if (size >= (1 << 20))     std::snprintf(label, sizeof(label), "%zu MB", size >> 20);
+            else if (size >= (1 << 10)) std::snprintf(label, sizeof(label), "%zu KB", size >> 10);
+            else                       std::snprintf(label, sizeof(label), "%zu B", size);
+            std::printf("%-8s %12.2f %12.2f %12.2f %12.2f %12.2f\n", label, simple, soft, fnv, encode, decode);
+        }
+    }
+
+
+/*****************************************************************************/
+/* Hash quality                                                              */
+/*****************************************************************************/
+    typedef enc_u64 (*HashFn)(const char *, enc_u32);
+
+    static enc_u64 fnv(const char *str, enc_u32 len)
+    {
+        return FNV1a(str, len);
+    }
+
+    static constexpr struct { const char *name; HashFn fn; } hashes[] =
+        { { "simplehash", simplehash }
+        , { "FNV1a",      fnv        }
+        };
+
+    // Flip each input bit: every output bit should flip half the time.
+    // Mean is over all (input bit, output bit) pairs, worst is the pair furthest from 0.5.
+    static void avalanche(const HashFn fn, const enc_u32 len, double& mean, double& worst)
+    {
+        constexpr int samples = 2000;
+        const int inBits = (int)len * 8;
+        std::vector<int> flips(inBits * 64, 0);
+        std::mt19937_64 rng(len);
+        std::string key(len, '\0');
+
+        for (int s=0; s<samples; ++s)
+        {
+            for (char& c : key)
+                c = (char)rng();
+            const enc_u64 h = fn(key.data(), len);
+            for (int b=0; b<inBits; ++b)
+            {
+                key[b/8] ^= (char)(1 << (b%8));
+                enc_u64 diff = h ^ fn(key.data(), len);
+                key[b/8] ^= (char)(1 << (b%8));
+                for (; diff; diff &= diff-1)
+                    ++flips[b*64 + std::countr_zero(diff)];
+            }
+        }
+
+        double sum = 0;
+        worst = 0;
+        for (const int f : flips)
+        {
+            const double p = (double)f / samples;
+            sum += p;
+            worst = std::max(worst, std::fabs(p - 0.5));
+        }
+        mean = sum / (double)flips.size();
+    }
+
+    static std::vector<std::string> corpus(const int kind, const int n)
+    {
+        std::vector<std::string> names;
+        names.reserve(n);
+        char buf[128];
+        for (int i=0; i<n; ++i)
+        {
+            switch (kind)
+            {
+                case 0 : std::snprintf(buf, sizeof(buf), "api%d.example.com", i); break;
+                case 1 : std::snprintf(buf, sizeof(buf), "10.%d.%d.%d:443", (i >> 16) & 255, (i >> 8) & 255, i & 255); break;
+                case 2 : std::snprintf(buf, sizeof(buf), "svc-%05d.eu-west-%d.compute.internal:8080", i / 4, i % 4); break;
+                default: std::snprintf(buf, sizeof(buf), "www.example.com:%d", 1024 + i); break;
+            }
+            names.emplace_back(buf);
+        }
+        return names;
+    }
+
+    static constexpr const char *corpusNames[] = { "api<i>.example.com", "10.x.y.z:443", "svc-<i>.eu-west-<r>", "www.example.com:<port>" };
+
+    // Full 64-bit collisions, and collisions in the low bits against what a random function would give:
+    static void collisions(const HashFn fn, const std::vector<std::string>& names, const int lowBits, long long& full, long long& low, double& expectedLow)
+    {
+        std::vector<enc_u64> h;
+        h.reserve(names.size());
+        for (const std::string& s : names)
+            h.push_back(fn(s.data(), (enc_u32)s.size()));
+
+        std::sort(h.begin(), h.end());
+        full = (long long)(h.size() - (size_t)(std::unique(h.begin(), h.end()) - h.begin()));
+
+        const enc_u64 mask = (1ull << lowBits) - 1;
+        std::vector<unsigned char> used(mask + 1, 0);
+        low = 0;
+        for (const std::string& s : names)
+        {
+            unsigned char& u = used[fn(s.data(), (enc_u32)s.size()) & mask];
+            low += u;
+            u = 1;
+        }
+
+        const double n = (double)names.size(), m = (double)(mask + 1);
+        expectedLow = n - m * (1.0 - std::pow(1.0 - 1.0/m, n));
+    }
+
+    static void quality()
+    {
+        std::printf("\nAvalanche (flip rate per input/output bit pair, ideal 0.5)\n");
+        std::printf("%-11s %6s %10s %10s\n", "", "len", "mean", "worst");
+        for (const auto& hash : hashes)
+        {
+            for (const enc_u32 len : { 4u, 8u, 16u, 24u, 40u, 64u })
+            {
+                double mean, worst;
+                avalanche(hash.fn, len, mean, worst);
+                std::printf("%-11s %6u %10.4f %10.4f\n", hash.name, len, mean, worst);
+            }
+        }
+
+        constexpr int names = 200000;
+        constexpr int lowBits = 20;
+        std::printf("\nCollisions over %d host names (low: the lowest %d bits, vs a random function)\n", names, lowBits);
+        std::printf("%-11s %-24s %8s %10s %10s\n", "", "corpus", "64-bit", "low", "expected");
+        for (int kind=0; kind<4; ++kind)
+        {
+            const std::vector<std::string> hosts = corpus(kind, names);
+            for (const auto& hash : hashes)
+            {
+                long long full, low;
+                double expected;
+                collisions(hash.fn, hosts, lowBits, full, low, expected);
+                std::printf("%-11s %-24s %8lld %10lld %10.0f\n", hash.name, corpusNames[kind], full, low, expected);
+            }
+        }
+    }
+
+
+/*****************************************************************************/
+/* main                                                                      */
+/*****************************************************************************/
+int main(int argc, char **argv)
+{
+    int millis = 200;
+    bool checkOnly = false;
+    for (int i=1; i<argc; ++i)
+    {
+        const std::string_view arg = argv[i];
+        if (arg == "--millis" && i+1 < argc)
+            millis = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--check")
+            checkOnly = true;
+        else
+        {
+            std::fprintf(stderr, "usage: %s [--millis N] [--check]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    checkAnswers();
+    checkRoundTrips();
+    if (failures != 0)
+    {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("known answers and round-trips ok\n");
+
+    if (checkOnly)
+        return 0;
+
+    throughput(millis);
+    quality();
+    return 0;
+}
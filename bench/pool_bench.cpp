@@ -0,0 +1,940 @@
+#include "connection.hpp"
+#include "global.hpp"
+#include "encode.hpp"
+#include "endpoint.hpp"
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/ssl.hpp>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+namespace http = boost::beast::http;
+using tcp = boost::asio::ip::tcp;
+using Clock = std::chrono::steady_clock;
+
+/* Loopback benchmark of Pool::request() and Pool::requestSSL()
+
+   ./net_bench [--requests N] [--concurrency N] [--body BYTES] [--post BYTES]
+               [--keepalive RATIO] [--shards N] [--server-threads N] [--plain|--ssl]
+               [--mode completion|reply|batch|stream|zerocopy|pipeline|prewarm|auth|socks5]
+               [--socks-idle MS]
+
+   completion  request() with a Completion (default)
+   reply       request() without one, polled with getReplies(), bodies back via releaseBody()
+   batch       requestBatch() in windows of 'concurrency'
+   stream      requestStream(), a Sink sees the chunks
+   zerocopy    requestZeroCopy()
+   pipeline    pipelineDepth 8 over one connection
+   prewarm     prewarm() with keepWarm instead of a warmup run
+   auth        two users on one host, the server echoes Authorization: a reply
+               carrying the other user's credentials counts as failed
+   socks5      requestSocks5() through an in-process SOCKS5 stand-in, polled like
+               'reply'. New connections start on the pool's warm spares; with
+               --socks-idle the stand-in drops spares idle that long, and with
+               --keepalive below 1 they are taken all through the run
+
+   The servers run in-process on their own threads, so the numbers are the
+   pool's own cost plus loopback. Allocations are those of the client side:
+   the caller, the io thread and the shards (server threads aren't counted).
+*/
+
+
+/*****************************************************************************/
+/* Allocation counting                                                       */
+/*****************************************************************************/
+    static std::atomic<long long> allocations{0};
+    static thread_local bool uncounted = false; // Set on the server threads
+
+    // Not inlined, gcc would take the free() at the call sites for a mismatch:
+    [[gnu::noinline]] void *operator new(std::size_t size)
+    {
+        if (uncounted == false)
+            allocations.fetch_add(1, std::memory_order_relaxed);
+        if (void *p = std::malloc(size ? size : 1))
+            return p;
+        throw std::bad_alloc();
+    }
+
+    [[gnu::noinline]] void operator delete(void *p) noexcept
+    {
+        std::free(p);
+    }
+
+    [[gnu::noinline]] void operator delete(void *p, std::size_t) noexcept
+    {
+        std::free(p);
+    }
+
+
+/*****************************************************************************/
+/* Loopback server                                                           */
+/*****************************************************************************/
+    enum class Mode { completion, reply, batch, stream, zerocopy, pipeline, prewarm, auth, socks5 };
+
+    static constexpr const char *modeNames[] = {"completion", "reply", "batch", "stream", "zerocopy", "pipeline", "prewarm", "auth", "socks5"};
+
+    struct Options
+    {
+        int     requests      = 100000;
+        int     concurrency   = 16;
+        int     body          = 1024;   // Response body
+        int     post          = 0;      // >0: POST a body this size instead of GET
+        double  keepAlive     = 1.0;    // Share of responses that keep the connection open
+        int     shards        = 0;
+        int     serverThreads = 2;
+        bool    plain         = true;
+        bool    ssl           = true;
+        Mode    mode          = Mode::completion;
+        int     socksIdleMs   = 0;      // >0: the SOCKS5 stand-in drops greeted connections idle this long
+    };
+
+    /****************************************/
+    /*        Self-signed cert, 'localhost' */
+    /****************************************/
+    static bool selfSigned(std::string& certPem, std::string& keyPem)
+    {
+        EVP_PKEY *key = EVP_EC_gen("P-256");
+        X509 *cert = X509_new();
+        if (key == nullptr || cert == nullptr)
+            return false;
+
+        ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+        X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 24*3600);
+        X509_set_pubkey(cert, key);
+        X509_NAME *name = X509_get_subject_name(cert);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)"localhost", -1, -1, 0);
+        X509_set_issuer_name(cert, name);
+        const bool signedOk = X509_sign(cert, key, EVP_sha256()) > 0;
+
+        auto pem = [](BIO *bio)
+                   {
+                       char *data = nullptr;
+                       const long len = BIO_get_mem_data(bio, &data);
+                       std::string s(data, (size_t)len);
+                       BIO_free(bio);
+                       return s;
+                   };
+        BIO *certBio = BIO_new(BIO_s_mem());
+        BIO *keyBio = BIO_new(BIO_s_mem());
+        PEM_write_bio_X509(certBio, cert);
+        PEM_write_bio_PrivateKey(keyBio, key, nullptr, nullptr, 0, nullptr, nullptr);
+        certPem = pem(certBio);
+        keyPem = pem(keyBio);
+
+        X509_free(cert);
+        EVP_PKEY_free(key);
+        return signedOk;
+    }
+
+    class Server
+    {
+    private:
+        asio::io_context                ioc;
+        asio::ssl::context              tls;
+        tcp::acceptor                   plainAcceptor, sslAcceptor, socksAcceptor;
+        std::vector<std::thread>        threads;
+        const std::string               body;
+        const double                    keepAlive;
+        const int                       socksIdleMs;
+        std::atomic<unsigned long long> responses{0};
+
+    public:
+        std::atomic<unsigned long long> socksGreetings{0}, socksTunnels{0}, socksIdleDrops{0};
+
+    private:
+
+        // One session per accepted connection, answers until told to close:
+        template <class Stream>
+        struct Session : std::enable_shared_from_this<Session<Stream>>
+        {
+            Server&                             server;
+            Stream                              stream;
+            beast::flat_buffer                  buffer;
+            std::optional<http::request_parser<http::string_body>> req; // Without the 1 MB default body_limit
+            http::response<http::string_body>   res;
+
+            Session(Server& s, tcp::socket&& sock)
+              : server(s)
+              , stream(make(s, std::move(sock)))
+            {}
+
+            static Stream make(Server& s, tcp::socket&& sock)
+            {
+                if constexpr (std::is_same_v<Stream, beast::tcp_stream>)
+                    return Stream(std::move(sock));
+                else
+                    return Stream(std::move(sock), s.tls);
+            }
+
+            void start()
+            {
+                if constexpr (std::is_same_v<Stream, beast::tcp_stream>)
+                    read();
+                else
+                    stream.async_handshake( asio::ssl::stream_base::server
+                                          , [self = this->shared_from_this()](beast::error_code ec)
+                                            {
+                                                if (!ec)
+                                                    self->read();
+                                            }
+                                          );
+            }
+
+            void read()
+            {
+                req.emplace();
+                req->body_limit(std::numeric_limits<std::uint64_t>::max());
+                http::async_read(stream, buffer, *req, [self = this->shared_from_this()](beast::error_code ec, size_t) { self->respond(ec); });
+            }
+
+            void respond(beast::error_code ec)
+            {
+                if (ec)
+                    return close();
+
+                res = {};
+                res.version(11);
+                res.result(http::status::ok);
+                // Echoes the credentials, to tell whose request this was:
+                if (const auto auth = req->get().find(http::field::authorization); auth != req->get().end())
+                    res.body() = std::string(auth->value());
+                else
+                    res.body() = server.body;
+                res.keep_alive(req->get().keep_alive() && server.keeps());
+                res.prepare_payload();
+                // HEAD (prewarm()'s pings): the length, but no body
+                if (req->get().method() == http::verb::head)
+                    res.body().clear();
+                http::async_write( stream
+                                 , res
+                                 , [self = this->shared_from_this()](beast::error_code writeEc, size_t)
+                                   {
+                                       if (writeEc || self->res.keep_alive() == false)
+                                           return self->close();
+                                       self->read();
+                                   }
+                                 );
+            }
+
+            void close()
+            {
+                beast::error_code ignored;
+                beast::get_lowest_layer(stream).socket().shutdown(tcp::socket::shutdown_both, ignored);
+            }
+        };
+
+        // SOCKS5 stand-in: no authentication, CONNECT only, every destination
+        // is on loopback. A greeted connection idle for 'socksIdleMs' is dropped,
+        // the way proxies drop the pool's spares:
+        struct Socks5 : std::enable_shared_from_this<Socks5>
+        {
+            Server&                                 server;
+            tcp::socket                             client, upstream;
+            asio::steady_timer                      idle;
+            std::array<unsigned char, 4+1+255+2>    buf;
+            std::array<char, 16384>                 down, up;
+            bool                                    requested = false;  // The CONNECT is in, a late idle timer must not drop it
+
+            Socks5(Server& s, tcp::socket&& sock)
+              : server(s)
+              , client(std::move(sock))
+              , upstream(client.get_executor())
+              , idle(client.get_executor())
+            {}
+
+            void start()
+            {
+                // VER NMETHODS METHODS...
+                asio::async_read( client
+                                , asio::buffer(buf.data(), 2)
+                                , [self = this->shared_from_this()](beast::error_code ec, size_t)
+                                  {
+                                      if (ec || self->buf[0] != 0x05)
+                                          return;
+                                      asio::async_read( self->client
+                                                      , asio::buffer(self->buf.data(), self->buf[1])
+                                                      , [self](beast::error_code ec2, size_t) { self->greet(ec2); }
+                                                      );
+                                  }
+                                );
+            }
+
+            void greet(beast::error_code ec)
+            {
+                if (ec)
+                    return;
+                buf[0] = 0x05;
+                buf[1] = 0x00;
+                asio::async_write( client
+                                 , asio::buffer(buf.data(), 2)
+                                 , [self = this->shared_from_this()](beast::error_code ec2, size_t)
+                                   {
+                                       if (ec2)
+                                           return;
+                                       self->awaitConnect();
+                                   }
+                                 );
+            }
+
+            void awaitConnect()
+            {
+                server.socksGreetings.fetch_add(1, std::memory_order_relaxed);
+                if (server.socksIdleMs > 0)
+                {
+                    idle.expires_after(std::chrono::milliseconds(server.socksIdleMs));
+                    idle.async_wait([self = this->shared_from_this()](beast::error_code ec)
+                                    {
+                                        if (ec || self->requested)
+                                            return;
+                                        self->server.socksIdleDrops.fetch_add(1, std::memory_order_relaxed);
+                                        beast::error_code ignored;
+                                        self->client.close(ignored);
+                                    }
+                                   );
+                }
+
+                // VER CMD RSV ATYP, then the address and the port:
+                asio::async_read( client
+                                , asio::buffer(buf.data(), 4)
+                                , [self = this->shared_from_this()](beast::error_code ec, size_t)
+                                  {
+                                      self->requested = true;
+                                      self->idle.cancel();
+                                      if (ec || self->buf[0] != 0x05 || self->buf[1] != 0x01)
+                                          return;
+                                      const unsigned char atyp = self->buf[3];
+                                      if (atyp == 0x03)
+                                          return asio::async_read( self->client
+                                                                 , asio::buffer(self->buf.data(), 1)
+                                                                 , [self](beast::error_code ec2, size_t)
+                                                                   {
+                                                                       if (ec2)
+                                                                           return;
+                                                                       self->readAddress(self->buf[0] + 2);
+                                                                   }
+                                                                 );
+                                      self->readAddress(atyp == 0x04 ? 16+2 : 4+2);
+                                  }
+                                );
+            }
+
+            // Host and port, the host doesn't matter:
+            void readAddress(const size_t len)
+            {
+                asio::async_read( client
+                                , asio::buffer(buf.data(), len)
+                                , [self = this->shared_from_this(), len](beast::error_code ec, size_t)
+                                  {
+                                      if (ec)
+                                          return;
+                                      const unsigned short port = (unsigned short)(self->buf[len-2] << 8 | self->buf[len-1]);
+                                      self->upstream.async_connect( tcp::endpoint(asio::ip::address_v4::loopback(), port)
+                                                                  , [self](beast::error_code ec2) { self->connected(ec2); }
+                                                                  );
+                                  }
+                                );
+            }
+
+            void connected(beast::error_code ec)
+            {
+                // VER REP RSV ATYP(IPv4) BND.ADDR BND.PORT:
+                buf = {};
+                buf[0] = 0x05;
+                buf[1] = ec ? 0x05 : 0x00; // Connection refused
+                buf[3] = 0x01;
+                asio::async_write( client
+                                 , asio::buffer(buf.data(), 10)
+                                 , [self = this->shared_from_this(), failed = (bool)ec](beast::error_code ec2, size_t)
+                                   {
+                                       if (ec2 || failed)
+                                           return;
+                                       self->server.socksTunnels.fetch_add(1, std::memory_order_relaxed);
+                                       self->relay(self->client, self->upstream, self->up);
+                                       self->relay(self->upstream, self->client, self->down);
+                                   }
+                                 );
+            }
+
+            // One direction of the tunnel, an end of stream is passed on as such:
+            void relay(tcp::socket& from, tcp::socket& to, std::array<char, 16384>& chunk)
+            {
+                from.async_read_some( asio::buffer(chunk)
+                                    , [self = this->shared_from_this(), &from, &to, &chunk](beast::error_code ec, size_t n)
+                                      {
+                                          beast::error_code ignored;
+                                          if (ec)
+                                              return (void)to.shutdown(tcp::socket::shutdown_send, ignored);
+                                          asio::async_write( to
+                                                           , asio::buffer(chunk.data(), n)
+                                                           , [self, &from, &to, &chunk](beast::error_code ec2, size_t)
+                                                             {
+                                                                 if (ec2)
+                                                                     return;
+                                                                 self->relay(from, to, chunk);
+                                                             }
+                                                           );
+                                      }
+                                    );
+            }
+        };
+
+        // Spreads the closes evenly: 'keepAlive' 0.75 closes every 4th
+        bool keeps()
+        {
+            const unsigned long long n = responses.fetch_add(1, std::memory_order_relaxed);
+            const double closing = 1.0 - keepAlive;
+            return std::floor((double)(n+1) * closing) == std::floor((double)n * closing);
+        }
+
+        template <class Stream>
+        void accept(tcp::acceptor& acceptor)
+        {
+            acceptor.async_accept( asio::make_strand(ioc)
+                                 , [this, &acceptor](beast::error_code ec, tcp::socket sock)
+                                   {
+                                       if (ec)
+                                           return;
+                                       // Pipelined responses would otherwise wait on the client's delayed ACK:
+                                       sock.set_option(tcp::no_delay(true), ec);
+                                       std::make_shared<Session<Stream>>(*this, std::move(sock))->start();
+                                       accept<Stream>(acceptor);
+                                   }
+                                 );
+        }
+
+        void acceptSocks5()
+        {
+            socksAcceptor.async_accept( asio::make_strand(ioc)
+                                      , [this](beast::error_code ec, tcp::socket sock)
+                                        {
+                                            if (ec)
+                                                return;
+                                            sock.set_option(tcp::no_delay(true), ec);
+                                            std::make_shared<Socks5>(*this, std::move(sock))->start();
+                                            acceptSocks5();
+                                        }
+                                      );
+        }
+
+    public:
+        Server(const Options& o, const std::string& certPem, const std::string& keyPem)
+          : tls(asio::ssl::context::tls_server)
+          , plainAcceptor(ioc, tcp::endpoint(asio::ip::address_v4::loopback(), 0))
+          , sslAcceptor(ioc, tcp::endpoint(asio::ip::address_v4::loopback(), 0))
+          , socksAcceptor(ioc, tcp::endpoint(asio::ip::address_v4::loopback(), 0))
+          , body((size_t)o.body, 'x')
+          , keepAlive(std::clamp(o.keepAlive, 0.0, 1.0))
+          , socksIdleMs(std::max(o.socksIdleMs, 0))
+        {
+            tls.use_certificate_chain(asio::buffer(certPem));
+            tls.use_private_key(asio::buffer(keyPem), asio::ssl::context::pem);
+
+            accept<beast::tcp_stream>(plainAcceptor);
+            accept<beast::ssl_stream<beast::tcp_stream>>(sslAcceptor);
+            acceptSocks5();
+
+            for (int i=0; i<std::max(o.serverThreads, 1); ++i)
+                threads.emplace_back([this]
+                                     {
+                                         uncounted = true;
+                                         ioc.run();
+                                     }
+                                    );
+        }
+
+        Server(const Server&) = delete;
+        Server& operator=(const Server&) = delete;
+
+        ~Server()
+        {
+            ioc.stop();
+            for (auto& thread : threads)
+                thread.join();
+        }
+
+        unsigned short plainPort() const { return plainAcceptor.local_endpoint().port(); }
+        unsigned short sslPort() const { return sslAcceptor.local_endpoint().port(); }
+        unsigned short socksPort() const { return socksAcceptor.local_endpoint().port(); }
+    };
+
+
+/*****************************************************************************/
+/* Client side                                                               */
+/*****************************************************************************/
+    /****************************************/
+    /* Closed loop: every completion issues */
+    /* the next request, 'concurrency' stay */
+    /* in flight. 'batch' and 'reply' go in */
+    /* windows of 'concurrency' instead.    */
+    /****************************************/
+    struct Run
+    {
+        Pool&                           pool;
+        const Mode                      mode;
+        const bool                      ssl;
+        const std::string               host;
+        const std::string               payload;
+        const int                       bodySize;
+        const int                       total;
+        unsigned short                  socks5port = 0;
+        std::string                     users[2], expected[2]; // Mode::auth, by id%2
+        std::vector<Clock::time_point>  started;
+        std::vector<long long>          latencyNs;
+        std::vector<long long>          streamed;  // Mode::stream, bytes so far
+        std::atomic<int>                issued{0}, completed{0}, failed{0};
+
+        Run(Pool& p, const Mode m, const bool s, const std::string& h, const int post, const int body, const int n)
+          : pool(p)
+          , mode(m)
+          , ssl(s)
+          , host(h)
+          , payload((size_t)post, 'y')
+          , bodySize(body)
+          , total(n)
+          , started((size_t)n)
+          , latencyNs((size_t)n)
+          , streamed(mode == Mode::stream ? (size_t)n : 0)
+        {
+            // The server echoes the Authorization header, each reply has to carry its own:
+            const char *userpw[2] = {"alice:a1", "bob:b2"};
+            for (int i=0; i<2; ++i)
+            {
+                const int len = (int)std::strlen(userpw[i]);
+                std::string b64((size_t)base64encode_getRequiredSize(len), '\0');
+                base64encode(b64.data(), userpw[i], len);
+                users[i] = std::string(userpw[i]) + "@" + host;
+                expected[i] = "Basic " + b64;
+            }
+        }
+
+        bool windowed() const
+        {
+            return mode == Mode::batch || mode == Mode::reply || mode == Mode::socks5;
+        }
+
+        Pool::Method method() const
+        {
+            return payload.empty() ? Pool::Method::GET : Pool::Method::POST;
+        }
+
+        const std::string& site(const int id) const
+        {
+            return mode == Mode::auth ? users[id % 2] : host;
+        }
+
+        bool good(const int id, const int statusCode, const char *body, const int bodylen) const
+        {
+            if (statusCode != 200)
+                return false;
+            if (mode == Mode::auth)
+                return std::string_view(body, (size_t)bodylen) == expected[id % 2];
+            return bodylen == bodySize;
+        }
+
+        void finish(const int id, const bool ok)
+        {
+            latencyNs[id] = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - started[id]).count();
+            if (ok == false)
+                failed.fetch_add(1, std::memory_order_relaxed);
+            if (windowed() == false)
+                next();
+            completed.fetch_add(1, std::memory_order_release);
+        }
+
+        static void onDone(void *user, const int callerId, const int statusCode, const char *body, const int bodylen)
+        {
+            Run& run = *(Run *)user;
+            run.finish(callerId, run.good(callerId, statusCode, body, bodylen));
+        }
+
+        static void onChunk(void *user, const int callerId, const int statusCode, const char *, const int len, const bool last)
+        {
+            Run& run = *(Run *)user;
+            run.streamed[callerId] += len;
+            if (last)
+                run.finish(callerId, statusCode == 200 && run.streamed[callerId] == run.bodySize);
+        }
+
+        void next()
+        {
+            const int id = issued.fetch_add(1, std::memory_order_relaxed);
+            if (id >= total)
+                return;
+
+            static constexpr char url[] = "/bench";
+            const std::string& to = site(id);
+            started[id] = Clock::now();
+            switch (mode)
+            {
+                case Mode::stream:
+                    if (ssl)
+                        pool.requestStreamSSL(id, to.data(), (int)to.size(), url, (int)sizeof(url)-1, payload.data(), (int)payload.size(), "", 0, "", 0, method(), Pool::Format::TEXT, &Run::onChunk, this);
+                    else
+                        pool.requestStream(id, to.data(), (int)to.size(), url, (int)sizeof(url)-1, payload.data(), (int)payload.size(), "", 0, "", 0, method(), Pool::Format::TEXT, &Run::onChunk, this);
+                    break;
+                case Mode::zerocopy:
+                    if (ssl)
+                        pool.requestZeroCopySSL(id, to.data(), (int)to.size(), url, (int)sizeof(url)-1, payload.data(), (int)payload.size(), "", 0, "", 0, method(), Pool::Format::TEXT, &Run::onDone, this);
+                    else
+                        pool.requestZeroCopy(id, to.data(), (int)to.size(), url, (int)sizeof(url)-1, payload.data(), (int)payload.size(), "", 0, "", 0, method(), Pool::Format::TEXT, &Run::onDone, this);
+                    break;
+                case Mode::socks5:
+                    if (ssl)
+                        pool.requestSocks5SSL(id, to.data(), (int)to.size(), url, (int)sizeof(url)-1, payload.data(), (int)payload.size(), "", 0, "", 0, method(), Pool::Format::TEXT, socks5port);
+                    else
+                        pool.requestSocks5(id, to.data(), (int)to.size(), url, (int)sizeof(url)-1, payload.data(), (int)payload.size(), "", 0, "", 0, method(), Pool::Format::TEXT, socks5port);
+                    break;
+                case Mode::reply:
+                    if (ssl)
+                        pool.requestSSL(id, to.data(), (int)to.size(), url, (int)sizeof(url)-1, payload.data(), (int)payload.size(), "", 0, "", 0, method(), Pool::Format::TEXT);
+                    else
+                        pool.request(id, to.data(), (int)to.size(), url, (int)sizeof(url)-1, payload.data(), (int)payload.size(), "", 0, "", 0, method(), Pool::Format::TEXT);
+                    break;
+                default:
+                    if (ssl)
+                        pool.requestSSL(id, to.data(), (int)to.size(), url, (int)sizeof(url)-1, payload.data(), (int)payload.size(), "", 0, "", 0, method(), Pool::Format::TEXT, &Run::onDone, this);
+                    else
+                        pool.request(id, to.data(), (int)to.size(), url, (int)sizeof(url)-1, payload.data(), (int)payload.size(), "", 0, "", 0, method(), Pool::Format::TEXT, &Run::onDone, this);
+                    break;
+            }
+        }
+
+        // All of a window in one requestBatch() call:
+        void batch(const int first, const int n)
+        {
+            static constexpr char url[] = "/bench";
+            std::vector<Pool::Request> requests((size_t)n);
+            for (int i=0; i<n; ++i)
+            {
+                Pool::Request& r = requests[(size_t)i];
+                const std::string& to = site(first + i);
+                r.callerId      = first + i;
+                r.userPwHost    = to.data();
+                r.userPwHostLen = (int)to.size();
+                r.url           = url;
+                r.urllen        = (int)sizeof(url)-1;
+                r.data          = payload.data();
+                r.datalen       = (int)payload.size();
+                r.method        = method();
+                r.ssl           = ssl;
+                r.onDone        = &Run::onDone;
+                r.user          = this;
+                started[(size_t)(first + i)] = Clock::now();
+            }
+            pool.requestBatch(requests.data(), n);
+        }
+
+        // Polls getReplies() until the window is in, bodies go back through releaseBody().
+        // Failed requests leave no reply, they count as failed once nothing moves for 1 s:
+        void collect(std::vector<int> ids)
+        {
+            std::vector<std::string> bodies(ids.size());
+            std::vector<int> statuses(ids.size());
+            Clock::time_point progress = Clock::now();
+            while (ids.empty() == false && Clock::now() - progress < std::chrono::seconds(1))
+            {
+                if (pool.getReplies(ids.data(), (int)ids.size(), bodies.data(), statuses.data()) == 0)
+                {
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+                    continue;
+                }
+                progress = Clock::now();
+                size_t kept = 0;
+                for (size_t i=0; i<ids.size(); ++i)
+                {
+                    if (statuses[i] == 999)
+                    {
+                        ids[kept++] = ids[i];
+                        continue;
+                    }
+                    finish(ids[i], good(ids[i], statuses[i], bodies[i].data(), (int)bodies[i].size()));
+                    pool.releaseBody(&bodies[i]);
+                }
+                ids.resize(kept);
+            }
+            for (const int id : ids)
+                finish(id, false);
+        }
+
+        void go(const int concurrency)
+        {
+            if (windowed() == false)
+            {
+                for (int i=0; i<std::min(concurrency, total); ++i)
+                    next();
+                while (completed.load(std::memory_order_acquire) < total)
+                    std::this_thread::sleep_for(std::chrono::microseconds(200));
+                return;
+            }
+
+            for (int first=0; first<total; first+=concurrency)
+            {
+                const int n = std::min(concurrency, total - first);
+                if (mode == Mode::batch)
+                {
+                    issued.store(first + n, std::memory_order_relaxed);
+                    batch(first, n);
+                    while (completed.load(std::memory_order_acquire) < first + n)
+                        std::this_thread::sleep_for(std::chrono::microseconds(200));
+                    continue;
+                }
+                std::vector<int> ids((size_t)n);
+                for (int i=0; i<n; ++i)
+                {
+                    ids[(size_t)i] = first + i;
+                    next();
+                }
+                collect(std::move(ids));
+            }
+        }
+    };
+
+    static long long percentile(const std::vector<long long>& sorted, const double p)
+    {
+        if (sorted.empty())
+            return 0;
+        const size_t rank = (size_t)std::ceil(p / 100.0 * (double)sorted.size());
+        return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+    }
+
+    // false: polled bodies still allocated once warm
+    static bool bench(const Options& o, Server& server, const bool ssl)
+    {
+        // Classic mode runs on the global io_context, shards bring their own threads:
+        Global global;
+        auto work = asio::make_work_guard(global.ioContext);
+        std::thread io([&global] { global.ioContext.run(); });
+
+        Pool::Limits limits;
+        limits.shards            = o.shards;
+        limits.connections       = 0;
+        limits.connectionsSSL    = 0;
+        limits.maxConnections    = o.concurrency;
+        limits.maxConnectionsSSL = o.concurrency;
+        limits.maxPerHost        = o.concurrency;
+        limits.maxQueued         = o.concurrency;
+        limits.idleSecs          = 60;
+        if (o.mode == Mode::pipeline)
+        {
+            // All of it down one connection:
+            limits.pipelineDepth = 8;
+            limits.maxPerHost    = 1;
+        }
+        if (o.mode == Mode::prewarm)
+            limits.keepWarmSecs = 1;
+        Pool pool(&global, limits);
+
+        const std::string host = std::string(ssl ? "localhost:" : "127.0.0.1:") + std::to_string(ssl ? server.sslPort() : server.plainPort());
+
+        // Connections, DNS and TLS sessions in place before measuring, or
+        // prewarm()'s one connection (its pings run alongside the requests):
+        if (o.mode == Mode::prewarm)
+        {
+            pool.prewarm(host.data(), (int)host.size(), ssl, true);
+            const Clock::time_point giveUp = Clock::now() + std::chrono::seconds(5);
+            while (pool.stats().connected == 0 && Clock::now() < giveUp)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        else
+        {
+            Run warmup(pool, o.mode, ssl, host, o.post, o.body, std::max(o.concurrency*8, 256));
+            warmup.socks5port = server.socksPort();
+            warmup.go(o.concurrency);
+        }
+
+        Run run(pool, o.mode, ssl, host, o.post, o.body, o.requests);
+        run.socks5port = server.socksPort();
+        const Pool::Stats before = pool.stats();
+        const unsigned long long greetingsBefore = server.socksGreetings.load(), tunnelsBefore = server.socksTunnels.load(), dropsBefore = server.socksIdleDrops.load();
+        const long long allocsBefore = allocations.load(std::memory_order_relaxed);
+        const Clock::time_point t0 = Clock::now();
+
+        run.go(o.concurrency);
+
+        const double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+        const long long allocs = allocations.load(std::memory_order_relaxed) - allocsBefore;
+        const Pool::Stats after = pool.stats();
+
+        std::vector<long long> sorted = run.latencyNs;
+        std::sort(sorted.begin(), sorted.end());
+
+        std::printf( "%-5s %-10s conc %-4d body %-7d post %-7d keep-alive %.2f | %9.0f req/s | p50 %7.1f us  p99 %7.1f us  p999 %7.1f us | %6.2f allocs/req | connects %lld, reuses %lld, failed %d\n"
+                   , ssl ? "https" : "http"
+                   , modeNames[(int)o.mode]
+                   , o.concurrency
+                   , o.body
+                   , o.post
+                   , o.keepAlive
+                   , o.requests / secs
+                   , percentile(sorted, 50) / 1000.0
+                   , percentile(sorted, 99) / 1000.0
+                   , percentile(sorted, 99.9) / 1000.0
+                   , (double)allocs / o.requests
+                   , after.connects - before.connects
+                   , after.reuses - before.reuses
+                   , run.failed.load()
+                   );
+        if (o.mode == Mode::socks5)
+            std::printf( "      socks5: tunnels %llu, on warm spares %lld | proxy greetings %llu, idle spares dropped %llu\n"
+                       , server.socksTunnels.load() - tunnelsBefore
+                       , after.socksSpares - before.socksSpares
+                       , server.socksGreetings.load() - greetingsBefore
+                       , server.socksIdleDrops.load() - dropsBefore
+                       );
+
+        // Polled bodies come back through releaseBody(), once warm every reply should
+        // start on a recycled buffer. Bodies within the inline (SSO) buffer are never kept:
+        bool recycled = true;
+        if (o.mode == Mode::reply || o.mode == Mode::batch)
+        {
+            const long long fresh = after.freshBodies - before.freshBodies;
+            recycled = fresh == 0 || o.body <= (int)std::string().capacity();
+            std::printf( "      bodies: %lld of %d replies started without a recycled buffer%s\n"
+                       , fresh
+                       , o.requests
+                       , recycled ? "" : " (expected 0)"
+                       );
+        }
+
+        if (o.mode == Mode::prewarm)
+            pool.prewarm(host.data(), (int)host.size(), ssl, false);
+
+        // Completions fire before a connection is done with itself, stop the io before the pool goes:
+        work.reset();
+        global.ioContext.stop();
+        io.join();
+        return recycled;
+    }
+
+    static bool parse(int argc, char **argv, Options& o)
+    {
+        for (int i=1; i<argc; ++i)
+        {
+            const std::string_view arg = argv[i];
+            const char *value = i+1 < argc ? argv[i+1] : nullptr;
+            auto number = [&](auto& dst)
+                          {
+                              if (value == nullptr)
+                                  return false;
+                              dst = (std::remove_reference_t<decltype(dst)>)std::atof(value);
+                              ++i;
+                              return true;
+                          };
+
+            bool ok = true;
+            if (arg == "--requests")             ok = number(o.requests);
+            else if (arg == "--concurrency")     ok = number(o.concurrency);
+            else if (arg == "--body")            ok = number(o.body);
+            else if (arg == "--post")            ok = number(o.post);
+            else if (arg == "--keepalive")       ok = number(o.keepAlive);
+            else if (arg == "--shards")          ok = number(o.shards);
+            else if (arg == "--server-threads")  ok = number(o.serverThreads);
+            else if (arg == "--socks-idle")      ok = number(o.socksIdleMs);
+            else if (arg == "--plain")           o.ssl = false;
+            else if (arg == "--ssl")             o.plain = false;
+            else if (arg == "--mode")
+            {
+                ok = false;
+                for (int m=0; value != nullptr && m < (int)std::size(modeNames); ++m)
+                    if (value == std::string_view(modeNames[m]))
+                        o.mode = (Mode)m, ok = true;
+                i += ok;
+            }
+            else                                 ok = false;
+            if (ok == false)
+                return false;
+        }
+        o.requests = std::max(o.requests, 1);
+        o.concurrency = std::max(o.concurrency, 1);
+        o.body = std::max(o.body, 0);
+        o.post = std::max(o.post, 0);
+        return true;
+    }
+
+
+/*****************************************************************************/
+/* Endpoint                                                                  */
+/*****************************************************************************/
+    // Must come out as request() and cacheHeaders() make them at run time:
+    using BasicEndpoint = Endpoint<"https://user:p@ss@api.example.com", Pool::Method::POST>;
+    using TokenEndpoint = Endpoint<"api.example.com:8443", Pool::Method::GET, Pool::Format::JSON, "Bearer t0k">;
+
+    static constexpr std::string_view view(const char *s, const int len)
+    {
+        return std::string_view(s, (size_t)len);
+    }
+
+    static_assert(BasicEndpoint::ssl && TokenEndpoint::ssl == false);
+    // Split at the first '@', like establish():
+    static_assert(view(BasicEndpoint::prepared.userpw, BasicEndpoint::prepared.userpwLen) == "user:p");
+    static_assert(view(BasicEndpoint::prepared.host, BasicEndpoint::prepared.hostLen) == "ss@api.example.com");
+    static_assert(view(BasicEndpoint::prepared.port, BasicEndpoint::prepared.portLen) == "443");
+    static_assert(view(BasicEndpoint::prepared.headers, BasicEndpoint::prepared.headersLen)
+                  == "Host: ss@api.example.com\r\nConnection: Keep-Alive\r\nAuthorization: Basic dXNlcjpw\r\n");
+    static_assert(view(TokenEndpoint::prepared.sni, TokenEndpoint::prepared.sniLen) == "api.example.com");
+    static_assert(view(TokenEndpoint::prepared.port, TokenEndpoint::prepared.portLen) == "8443");
+    static_assert(view(TokenEndpoint::prepared.headers, TokenEndpoint::prepared.headersLen)
+                  == "Host: api.example.com:8443\r\nConnection: Keep-Alive\r\nAuthorization: Bearer t0k\r\n");
+
+    // The pool routes on simplehash(), whichever kernel this CPU runs:
+    template <typename E>
+    static bool sameHash()
+    {
+        return E::prepared.hostHash == simplehash(E::prepared.site, (enc_u32)E::prepared.siteLen);
+    }
+
+
+/*****************************************************************************/
+/* main                                                                      */
+/*****************************************************************************/
+int main(int argc, char **argv)
+{
+    Options o;
+    if (parse(argc, argv, o) == false)
+    {
+        std::fprintf(stderr, "usage: %s [--requests N] [--concurrency N] [--body BYTES] [--post BYTES] [--keepalive RATIO] [--shards N] [--server-threads N] [--plain|--ssl]\n"
+                             "       [--mode completion|reply|batch|stream|zerocopy|pipeline|prewarm|auth|socks5] [--socks-idle MS]\n", argv[0]);
+        return 1;
+    }
+
+    if (sameHash<BasicEndpoint>() == false || sameHash<TokenEndpoint>() == false)
+    {
+        std::fprintf(stderr, "Endpoint host hash differs from simplehash()\n");
+        return 1;
+    }
+
+    std::string certPem, keyPem;
+    if (selfSigned(certPem, keyPem) == false)
+    {
+        std::fprintf(stderr, "Could not create the test certificate\n");
+        return 1;
+    }
+
+    Server server(o, certPem, keyPem);
+
+    bool recycled = true;
+    if (o.plain)
+        recycled = bench(o, server, false) && recycled;
+    if (o.ssl)
+        recycled = bench(o, server, true) && recycled;
+    return recycled ? 0 : 1;
+}
@@ -78,8 +78,7 @@ workspace "net_base"
 
                 filter { "system:linux" }
                         toolset "gcc"
-                        buildoptions { "-march=native"
-                                     , "-pedantic"
+                        buildoptions { "-pedantic"
                                      , "-ffast-math"
                                      , gcc_buildoption_utf8compiler
                                      , gcc_buildoption_fatal
@@ -116,5 +115,90 @@ workspace "net_base"
 
                 filter {}
 
+
+
+        -- Loopback benchmark of the pool: ./net_bench --help
+        project "net_bench"
+                language "c++"
+                kind "ConsoleApp"
+                cppdialect "C++20"
+                toolset "gcc"
+                rtti "Off"
+                exceptionhandling "On"
+                warnings "extra"
+                files { "../bench/pool_bench.cpp",
+                        "../src_net/connection.cpp",
+                        "../src_net/encode.cpp",
+                        "../src_net/*.hpp"
+                      }
+                includedirs { "../src_net" }
+                targetdir "../"
+
+                filter { "system:linux" }
+                        toolset "gcc"
+                        buildoptions { "-pedantic"
+                                     , gcc_buildoption_fatal
+                                     , gcc_buildoption_shadow
+                                     }
+                        defines { protect_strings,
+                                  remove_strings
+                                }
+                        location "../build_linux"
+                        links { "pthread",
+                                "crypto",
+                                "ssl"
+                              }
+
+                filter {}
+
+                filter "configurations:Debug"
+                        symbols "On"
+                        defines "_DEBUG"
+                        optimize "Speed"
+
+                filter "configurations:Release"
+                        symbols "Off"
+                        defines "NDEBUG"
+                        optimize "Full"
+
+                filter {}
+
+        project "encode_bench"
+                language "c++"
+                kind "ConsoleApp"
+                cppdialect "C++20"
+                toolset "gcc"
+                rtti "Off"
+                exceptionhandling "On"
+                warnings "extra"
+                files { "../bench/encode_bench.cpp",
+                        "../src_net/encode.cpp",
+                        "../src_net/encode.hpp"
+                      }
+                includedirs { "../src_net" }
+                targetdir "../"
+
+                filter { "system:linux" }
+                        toolset "gcc"
+                        buildoptions { "-pedantic"
+                                     , gcc_buildoption_fatal
+                                     , gcc_buildoption_shadow
+                                     }
+                        location "../build_linux"
+
+                filter {}
+
+                filter "configurations:Debug"
+                        symbols "On"
+                        defines "_DEBUG"
+                        optimize "Speed"
+
+                filter "configurations:Release"
+                        symbols "Off"
+                        defines "NDEBUG"
+                        optimize "Full"
+
+                filter {}
+
 print("done")
 os.remove("Makefile")
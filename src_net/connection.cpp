@@ -11,12 +11,24 @@
         put "libcrypto.lib;libssl.lib"
 */
 #include <boost/beast/ssl.hpp>
-#include <boost/lexical_cast.hpp>
+#include <algorithm>
 #include <vector>
 #include <string_view>
 #include <optional>
-#include <unordered_map>
+#include <deque>
 #include <cstdint>
+#include <chrono>
+#include <limits>
+#include <array>
+#include <charconv>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#ifndef _WIN32
+  #include <pthread.h>
+#endif
 
 typedef std::uint_fast64_t u64;
 typedef std::uint_fast32_t u32;
@@ -34,7 +46,7 @@ using std::unique_ptr;
 using std::optional;
 using std::lock_guard;
 using std::mutex;
-using std::unordered_map;
+using std::deque;
 namespace asio = boost::asio;
 namespace beast = boost::beast;
 namespace http = boost::beast::http;
@@ -55,420 +67,2347 @@ using enum Debug::Level;
         string    reply;
     };
 
-    
-    /****************************************/
-    /*                            getSock() */
-    /****************************************/
-    inline auto& getSock(beast::tcp_stream& sock)
-    {
-        return sock;
-    }
-    
-    inline auto& getSock(beast::ssl_stream<beast::tcp_stream>& sock)
-    {
-        return beast::get_lowest_layer(sock);
-    }
-            
-    
+
     /****************************************/
-    /*                              TLS/SSL */
+    /*               Recycled reply buffers */
+    /*                                      */
+    /* Bodies are parsed straight into one  */
+    /* of these and moved, never copied,    */
+    /* until the consumer gives it back.    */
+    /*                                      */
+    /* Lock-free: every reply passes here   */
+    /* on the io threads and the callers'.  */
+    /* Two stacks over fixed nodes, those   */
+    /* holding a buffer and the empty ones. */
     /****************************************/
-    struct SSL_on
-    {
-        boost::asio::ssl::context ssl_ctx;
-        
-        static constexpr bool DoSSL = true;
-        
-        SSL_on()
-          : ssl_ctx(boost::asio::ssl::context::tlsv12_client)
-        {}
-    };
-        
-    
-    struct SSL_off
+    class BodyPool
     {
-        static constexpr bool DoSSL = false;
-    };
-
+    private:
+        static constexpr size_t maxKeep = 1*1024*1024; // Bigger buffers go back to the heap
 
-    /****************************************/
-    /*                Single Tcp Connection */
-    /****************************************/
-    template <class Sockettype, class SSL>
-    struct TcpConnection : public SSL
-    {  
-        unique_ptr<AtomicFlag> busy;
+        struct Node
+        {
+            string                      body;
+            std::atomic<std::uint32_t>  next{0};
+        };
 
-        unique_ptr<std::atomic<u64>> hostHash;
+        // Index+1 of the top node (0: empty) in the low half, a tag
+        // bumped on every change in the high half against ABA:
+        class Stack
+        {
+        private:
+            std::atomic<std::uint64_t> top{0};
 
-        unique_ptr<Sockettype> stream;
+        public:
+            void push(Node *nodes, const std::uint32_t i)
+            {
+                std::uint64_t t = top.load(std::memory_order_relaxed);
+                do
+                    nodes[i].next.store((std::uint32_t)t, std::memory_order_relaxed);
+                while (top.compare_exchange_weak(t, ((t >> 32) + 1) << 32 | (i + 1), std::memory_order_release, std::memory_order_relaxed) == false);
+            }
 
-        beast::flat_buffer buffer; // Must persist between reads
+            // false: empty
+            bool pop(Node *nodes, std::uint32_t& i)
+            {
+                std::uint64_t t = top.load(std::memory_order_acquire);
+                for (;;)
+                {
+                    if ((std::uint32_t)t == 0)
+                        return false;
+                    // Stale if someone popped it meanwhile, then the tag fails the exchange:
+                    const std::uint32_t next = nodes[(std::uint32_t)t - 1].next.load(std::memory_order_relaxed);
+                    if (top.compare_exchange_weak(t, ((t >> 32) + 1) << 32 | next, std::memory_order_acquire, std::memory_order_acquire))
+                    {
+                        i = (std::uint32_t)t - 1;
+                        return true;
+                    }
+                }
+            }
+        };
 
-        string host, userpw;
+        unique_ptr<Node[]>  nodes;
+        Stack               kept, spare;
 
-        asio::ip::tcp::resolver resolver;
+        // An empty string's capacity is the inline (SSO) buffer, no heap block to keep:
+        static bool keepable(const string& s)
+        {
+            return s.capacity() > string().capacity() && s.capacity() <= maxKeep;
+        }
 
-        boost::beast::http::request<boost::beast::http::string_body> req;
-        // Must be 'optional' to avoid 'double body' problem:
-        optional<boost::beast::http::response<boost::beast::http::string_body>> res; 
+    public:
+        std::atomic<i64> fresh = 0; // acquire()s that handed out no heap buffer
 
-        int callerId;
-        
-        int totalread = 0, totalConsecutiveReads = 0;
-    
-        boost::asio::deadline_timer keepaliveTimer;
-    
-        mutex&                        replies_lock;
-        unordered_map<int, Reply>&    replies;
-    
-        auto makeSock(asio::io_context& ioc) NON_CONST
+        explicit BodyPool(const int n)
+          : nodes(make_unique<Node[]>(std::max(n, 0)))
         {
-            if constexpr (this->DoSSL)
-                return make_unique<beast::ssl_stream<beast::tcp_stream>>(make_strand(ioc), this->ssl_ctx);
-            else
-                return make_unique<beast::tcp_stream>(make_strand(ioc));
+            for (int i=0; i<n; ++i)
+                spare.push(nodes.get(), (std::uint32_t)i);
         }
 
-        void setupHttpRequest( auto& req_
-                             , const Pool::Method method
-                             , string_view url
-                             , string_view data
-                             , string_view auth
-                             , string_view xApiKey
-                             , const Pool::Format format
-                             ) const
+        BodyPool(const BodyPool&) = delete;
+        BodyPool& operator=(const BodyPool&) = delete;
+
+        string acquire()
         {
-            req_.version(11); // http 1.1
-            
-            using enum Pool::Method;
-            switch (method)
-            {
-                default     :
-                case   GET : { req_.method(beast::http::verb::get); }
-                break;
-                case  POST : { req_.method(beast::http::verb::post);
-                               req_.set( beast::http::field::content_length
-                                       , boost::lexical_cast<std::string>(data.size())
-                                       );
-                              }
-                break;
-                case   PUT : { req_.method(beast::http::verb::put); }
-                break;
-                case DLETE : { req_.method(beast::http::verb::delete_); }
-                break;
-                case  HEAD : { req_.method(beast::http::verb::head); }
-                break;
-            }
-
-            //string target(userpw); todo: test/remove
-            //target += url;
-
-            req_.target(beast::string_view(url.data(), url.size()));
-            //req_.target(target);
-            req_.set(beast::http::field::host, host);
-            req_.set(beast::http::field::connection, PROTECTED("Keep-Alive"));
-            if (userpw.empty() == false)
+            string s;
+            if (std::uint32_t i; kept.pop(nodes.get(), i))
             {
-                string login(base64encode_getRequiredSize(userpw.size()), '\0');
-                base64encode(login.data(), userpw.c_str(), userpw.size());
-                req_.set(beast::http::field::authorization, PROTECTED("Basic ")+login); // login:pass => base64
-            }
-            else if (auth.empty() == false)
-            {
-                req_.set(http::field::authorization, auth);
+                s = std::move(nodes[i].body);
+                spare.push(nodes.get(), i);
             }
-            if (format == Pool::Format::JSON)
-                req_.set(PROTECTED("Content-Type"), PROTECTED("application/json"));
-            if (data.empty() == false)
+            if (keepable(s) == false)
+                fresh.fetch_add(1, std::memory_order_relaxed);
+            return s;
+        }
+
+        // Dropped when all nodes are taken:
+        void release(string&& s)
+        {
+            if (keepable(s) == false)
+                return;
+            if (std::uint32_t i; spare.pop(nodes.get(), i))
             {
-                req_.body() = data;
-                req_.prepare_payload(); // Adjust lenght and encoding based on body
+                s.clear();
+                nodes[i].body = std::move(s);
+                kept.push(nodes.get(), i);
             }
-            //if (xApiKey.empty() == false)
-              //  req_.set(PROTECTED("X-Api-Key"), xApiKey);
         }
+    };
+
+
+    /****************************************/
+    /*        Sharded store for the replies */
+    /*                                      */
+    /* Fixed capacity, open addressing on   */
+    /* the callerId. Every slot has its own */
+    /* state word, so inserts from the io   */
+    /* thread and takes from getReply()     */
+    /* never share a lock.                  */
+    /****************************************/
+    class ReplyStore
+    {
+    private:
+        static constexpr int nShards = 16;   // Power of 2
+        static constexpr int probeLen = 8;   // Slots searched per key
+        static constexpr u32 sweepEvery = 64; // Inserts per shard between TTL sweeps
+
+        enum : u8 { slot_free, slot_writing, slot_full, slot_reading };
     
-        TcpConnection(asio::io_context& ioc, mutex& mtx, unordered_map<int, Reply>& r)
-          : busy(std::make_unique<AtomicFlag>())
-          , hostHash(std::make_unique<std::atomic<u64>>(0))
-          , stream(makeSock(ioc))
-          , resolver(make_strand(ioc))
-          , keepaliveTimer(ioc)
-          , replies_lock(mtx)
-          , replies(r)
+        struct Slot
         {
-            busy->makeAvail();
-        }
-        
-        template <bool ConnectSocks5>
-        void establish( const int caller
-                      , string_view newhost
-                      , string_view url
-                      , string_view data
-                      , string_view auth
-                      , string_view xApiKey
-                      , const Pool::Method method
-                      , const Pool::Format format
-                      , const unsigned short socks5port)
+            std::atomic<u8>     state{slot_free};
+            std::atomic<int>    key{0};
+            std::atomic<i64>    stamp{0};     // Insert time, ms
+            Reply               reply;
+        };
+
+        struct Shard
         {
-            // We remain busy for the whole operation:
-            const AtomicFlag::State isBusy = busy->isAvail_then_lock();
-            boost::ignore_unused(isBusy);
+            unique_ptr<Slot[]>  slots;
+            std::atomic<u32>    inserts{0};
+        };
+
+        Shard shards[nShards];
         
-            callerId = caller;
+        const int mask; // Slots per shard - 1
 
-            if ( const auto userpwPos = newhost.find("@")
-               ; userpwPos>0 && userpwPos<newhost.size()
-               )
-            {
-                userpw = newhost.substr(0, userpwPos);
-                host = newhost.substr(userpwPos+1);
-            }
-            else
-            {
-                host = newhost;
-            }
+        const i64 ttl;  // ms
 
-            hostHash->store(simplehash(host.data(), (int)host.size()), std::memory_order_relaxed);
+        BodyPool& bodies;
 
-            setupHttpRequest(req, method, url, data, auth, xApiKey, format);
-        
-            string port;
-            if ( const auto dblePoint = host.rfind(":")
-               ; dblePoint>0 && dblePoint<host.size()
-               )
-            {
-                port = host.substr(dblePoint+1);
-                host = host.substr(0, dblePoint);
-            }
+        // Exactly 32 bits wide, the top bits pick the shard:
+        static std::uint32_t mix(const int key)
+        {
+            return (std::uint32_t)key * 2654435769u;
+        }
+    
+        static i64 now()
+        {
+            using namespace std::chrono;
+            return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+        }
 
-            if (port.empty())
-            {
-                if constexpr (this->DoSSL)
-                    port = PROTECTED("443");
-                else
-                    port = PROTECTED("80");
-            }
+        static int slotsPerShard(const int capacity)
+        {
+            int n = probeLen;
+            while (n*nShards < capacity)
+                n <<= 1;
+            return n;
+        }
 
-            auto connect = [this](beast::error_code ec, asio::ip::tcp::resolver::results_type results)
-                           {
-                               if (ec)
-                               {
-                                   hostHash->store(0, std::memory_order_relaxed);
-                                   return Debug::print(Debug::Level::warning, REMOVED("[]connect: "), ec.message().c_str(), REMOVED(", host: "), host.c_str());
-                               }
-    
-                               // "10 seconds seems excessive for most sites" news.ycombinator.com/item?it=25832283
-                               getSock(*this->stream).expires_after(std::chrono::seconds(9));
+        bool claim(Slot& slot, u8 from)
+        {
+            return slot.state.compare_exchange_strong(from, slot_writing, std::memory_order_acquire, std::memory_order_relaxed);
+        }
 
-                               if constexpr (this->DoSSL)
-                                   getSock(*this->stream).async_connect(results, beast::bind_front_handler(&TcpConnection::handshake, this));
-                               else
-                                   getSock(*this->stream).async_connect(results, beast::bind_front_handler(&TcpConnection::write, this));
-                           };
+        void publish(Slot& slot, const int key, const int status, string&& body, const i64 t)
+        {
+            slot.key.store(key, std::memory_order_relaxed);
+            slot.stamp.store(t, std::memory_order_relaxed);
+            slot.reply.http_status = status;
+            bodies.release(std::move(slot.reply.reply));
+            slot.reply.reply = std::move(body);
+            slot.state.store(slot_full, std::memory_order_release);
+        }
 
-            if constexpr (ConnectSocks5)
+        void sweep(Shard& shard, const i64 t)
+        {
+            for (int i=0; i<=mask; ++i)
             {
-                // more detailed impl.: github.com/sehe/asio-socks45-client/blob/main/socks5.hpp
-                // stackoverflow.com/questions/69778112/is-there-a-native-support-for-proxy-connection-via-socks5-for-boostasio
-                // develop.socks-proto.cpp.al/socks/quick_look/async_client0.html
-                try
+                Slot& slot = shard.slots[i];
+                if ( slot.state.load(std::memory_order_relaxed) == slot_full
+                  && t - slot.stamp.load(std::memory_order_relaxed) > ttl
+                  && claim(slot, slot_full)
+                   )
                 {
-                    getSock(*stream).connect(asio::ip::tcp::endpoint({}, socks5port));
-    
-                    constexpr char greeting1[] = { 0x05 // socks5
-                                                 , 0x01 // One authentication method
-                                                 , 0x00 // No authentication
-                                                 };
-                    asio::write(getSock(*stream), asio::buffer(greeting1, sizeof(greeting1)));
-                    char resp1[2] = {0};
-                    asio::read(getSock(*stream), asio::buffer(resp1,2), asio::transfer_exactly(2));
-                    if (resp1[1] != 0x00)
-                        return Debug::print(Debug::Level::warning, REMOVED("TcpConnection::establish(): socks5 auth error "));
-                    vector<unsigned char> greeting2 = { 0x05 // socks 5
-                                                      , 0x01 // connect
-                                                      , 0x00 // reserved
-                                                      , 0x03 // "domain"
-                                                      , (unsigned char)(host.size() & 255) // hostname len
-                                                      };
-                    std::copy(host.begin(), host.end(), back_inserter(greeting2));            
-                    const unsigned short dstPort = (unsigned short)stoi(port) & 0xffff;
-                    const unsigned char msb = (unsigned char)((dstPort>>8) & 255),
-                                        lsb = (unsigned char)(dstPort & 255);
-                    greeting2.push_back( msb );
-                    greeting2.push_back( lsb );
-                    asio::write(getSock(*stream), asio::buffer(greeting2));
-                    char resp2[10] = {0};
-                    asio::read(getSock(*stream), asio::buffer(resp2, sizeof(resp2)), asio::transfer_exactly(sizeof(resp2)));
-                    if (resp2[1] != 0)
-                        return Debug::print(Debug::Level::warning, REMOVED("TcpConnection::establish(): socks5 error: "), (int)resp2[1]);
-                }
-                catch (...)
-                {
-                    return Debug::print(Debug::Level::warning, REMOVED("TcpConnection::establish(): Socks connect failed"));
+                    bodies.release(std::move(slot.reply.reply));
+                    slot.state.store(slot_free, std::memory_order_release);
                 }
-            
-                if constexpr (this->DoSSL)
+            }
+        }
+
+    public:
+        ReplyStore(const int capacity, const int ttlSecs, BodyPool& b)
+          : mask(slotsPerShard(capacity) - 1)
+          , ttl((i64)ttlSecs * 1000)
+          , bodies(b)
+        {
+            for (Shard& shard : shards)
+                shard.slots = std::make_unique<Slot[]>(mask + 1);
+        }
+
+        ReplyStore(const ReplyStore&) = delete;
+        ReplyStore& operator=(const ReplyStore&) = delete;
+
+        // Takes 'body' by move; false: no room, reply dropped
+        bool insert(const int key, const int status, string&& body)
+        {
+            const std::uint32_t h = mix(key);
+            Shard& shard = shards[h >> 28];
+            const i64 t = now();
+
+            if (shard.inserts.fetch_add(1, std::memory_order_relaxed) % sweepEvery == 0)
+                sweep(shard, t);
+
+            // An unclaimed reply for a reused callerId is replaced,
+            // otherwise take any free slot, otherwise an expired one:
+            for (int i=0; i<probeLen; ++i)
+            {
+                Slot& slot = shard.slots[(h + i) & mask];
+                for (;;)
                 {
-                    stream->async_handshake( asio::ssl::stream_base::handshake_type::client
-                                           , beast::bind_front_handler(&TcpConnection::writeSSL, this)
-                                           );
+                    const u8 state = slot.state.load(std::memory_order_acquire);
+                    if (state == slot_free || slot.key.load(std::memory_order_relaxed) != key)
+                        break;
+
+                    // A take() or another insert() has it for a moment. Skipped, a second
+                    // entry for the key could go in next to it, wait for it instead:
+                    if (state != slot_full || claim(slot, slot_full) == false)
+                    {
+                        std::this_thread::yield();
+                        continue;
+                    }
+
+                    // Slot may have been recycled for another key in between:
+                    if (slot.key.load(std::memory_order_relaxed) != key)
+                    {
+                        slot.state.store(slot_full, std::memory_order_release);
+                        break;
+                    }
+
+                    publish(slot, key, status, std::move(body), t);
+                    return true;
                 }
-                else
+            }
+            for (int i=0; i<probeLen; ++i)
+            {
+                Slot& slot = shard.slots[(h + i) & mask];
+                if (claim(slot, slot_free))
                 {
-                    beast::http::async_write(*stream, req, beast::bind_front_handler(&TcpConnection::read, this));   
+                    publish(slot, key, status, std::move(body), t);
+                    return true;
                 }
             }
-            else
+            for (int i=0; i<probeLen; ++i)
             {
-                resolver.async_resolve(host, port, connect);
+                Slot& slot = shard.slots[(h + i) & mask];
+                if ( t - slot.stamp.load(std::memory_order_relaxed) > ttl
+                  && claim(slot, slot_full)
+                   )
+                {
+                    publish(slot, key, status, std::move(body), t);
+                    return true;
+                }
             }
-    
-            boost::ignore_unused(connect, socks5port);
+            return false;
         }
 
-        void handshake(beast::error_code ec, asio::ip::tcp::resolver::endpoint_type)
-        {
-            if (ec)
-                return Debug::print(Debug::Level::warning, REMOVED("TcpConnection::handshake(): "), ec.message().c_str());
-            
-            if constexpr (this->DoSSL)
-                stream->async_handshake( asio::ssl::stream_base::handshake_type::client
-                                       , beast::bind_front_handler(&TcpConnection::writeSSL, this)
-                                       );
-        }
-    
-        void nextRequest( const int caller
-                        , string_view url
-                        , string_view data
-                        , string_view auth
-                        , string_view xApiKey
-                        , const Pool::Method method
-                        , const Pool::Format format
-                        )
+        // 'recycled' gets the buffer 'dst' held before:
+        bool take(const int key, string& dst, int& status, const i64 t, string& recycled)
         {
-            // keepaliveTimer.cancel(); // timer automatically reset!
-    
-            callerId = caller;
+            const std::uint32_t h = mix(key);
+            Shard& shard = shards[h >> 28];
 
-            setupHttpRequest(req, method, url, data, auth, xApiKey, format);
-            
-            getSock(*stream).expires_after(std::chrono::seconds(30));
-    
-            if (getSock(*stream).socket().is_open() == false)
-                return Debug::print(Debug::Level::warning, REMOVED("TcpConnection::nextRequest(): sock already closed"));
+            for (int i=0; i<probeLen; ++i)
+            {
+                Slot& slot = shard.slots[(h + i) & mask];
+                if ( slot.state.load(std::memory_order_relaxed) != slot_full
+                  || slot.key.load(std::memory_order_relaxed) != key
+                   )
+                    continue;
                 
-            beast::http::async_write(*stream, req, beast::bind_front_handler(&TcpConnection::read, this));
+                if (u8 full = slot_full; slot.state.compare_exchange_strong(full, slot_reading, std::memory_order_acquire, std::memory_order_relaxed) == false)
+                    continue;
+
+                // Slot may have been recycled for another key in between:
+                if (slot.key.load(std::memory_order_relaxed) != key)
+                {
+                    slot.state.store(slot_full, std::memory_order_release);
+                    continue;
+                }
+
+                // Expired but not swept yet, counts as gone:
+                const bool alive = t - slot.stamp.load(std::memory_order_relaxed) <= ttl;
+                if (alive)
+                {
+                    status = slot.reply.http_status;
+                    swap(dst, slot.reply.reply);
+                }
+                // Whatever 'dst' held before is recycled:
+                recycled = std::move(slot.reply.reply);
+                slot.state.store(slot_free, std::memory_order_release);
+                return alive;
+            }
+            return false;
         }
 
-        void write(beast::error_code ec, asio::ip::tcp::resolver::endpoint_type)
+        bool take(const int key, string& dst, int& status)
         {
-            return writeSSL(ec);
+            string recycled;
+            const bool found = take(key, dst, status, now(), recycled);
+            bodies.release(std::move(recycled));
+            return found;
         }
 
-        void writeSSL(beast::error_code ec)
+        // Many keys, one clock read. Status 999 where there is no reply:
+        int take(const int *keys, const int n, string *dsts, int *statuses)
         {
-            if (ec)
+            const i64 t = now();
+            int found = 0;
+            for (int i=0; i<n; ++i)
             {
-                Debug::print(Debug::Level::warning, REMOVED("TcpConnection::connect(): "), ec.message().c_str());
-                hostHash->store(0, std::memory_order_relaxed);
-                getSock(*stream).socket().shutdown(asio::ip::tcp::socket::shutdown_both, ec);
-                return;
+                string recycled;
+                if (take(keys[i], dsts[i], statuses[i], t, recycled))
+                    found += 1;
+                else
+                    statuses[i] = 999;
+                bodies.release(std::move(recycled));
             }
-    
-            getSock(*stream).expires_after(std::chrono::seconds(30));
-    
-            beast::http::async_write(*stream, req, beast::bind_front_handler(&TcpConnection::read, this));
+            return found;
         }
+    };
 
-        void read(beast::error_code ec, size_t bytes_transferred)
+
+    /****************************************/
+    /*                            DNS cache */
+    /*                                      */
+    /* host:port -> endpoints, pool-wide.   */
+    /* Failed lookups are remembered for a  */
+    /* short while. Entries that are still  */
+    /* in use get resolved again by the     */
+    /* Director before they expire.         */
+    /****************************************/
+    class DnsCache
+    {
+    public:
+        using Results = asio::ip::tcp::resolver::results_type;
+        using Clock = std::chrono::steady_clock;
+        
+    private:
+        struct Entry
         {
-            totalread += (int)bytes_transferred;
-            totalConsecutiveReads += 1;
+            Results                  results;
+            beast::error_code        ec;           // Set: negative entry
+            Clock::time_point        expires;
+            bool                     used = false; // Looked up since the last refresh
+            int                      family = 0;   // 4 or 6: connected first last time
+        };
 
-            static constexpr int maxlen = 1*1024*1024;
-            static constexpr int maxConsecutiveReads = 16;
+        mutex                        lock;
+        std::unordered_map<string, Entry> entries;
+        asio::ip::tcp::resolver      resolver;     // Refreshes only
+        Director                     director;
+        const std::chrono::seconds   ttl, negativeTtl;
 
-            if (totalread > maxlen)
-                return Debug::print(Debug::Level::warning, REMOVED("TcpConnection::read(): maxlen exceeded "), totalread);
-            if (totalConsecutiveReads > maxConsecutiveReads)
-                return Debug::print(Debug::Level::warning, REMOVED("TcpConnection::read(): maxreads exceeded "), totalConsecutiveReads);
-        
-            if (ec)
-            {
-                Debug::print(Debug::Level::warning, REMOVED("TcpConnection::read(): "), ec.message().c_str());
-                // reset & close:
-                hostHash->store(0, std::memory_order_relaxed);
-                getSock(*stream).socket().shutdown(asio::ip::tcp::socket::shutdown_both, ec);
-                return;
-            }
-            
-            res.reset();
-            res.emplace();
-            
-            beast::http::async_read(*stream, buffer, *res, beast::bind_front_handler(&TcpConnection::doneRead, this));
+        static string key(string_view host, string_view port)
+        {
+            string k;
+            k.reserve(host.size() + 1 + port.size());
+            k.append(host).append(1, ':').append(port);
+            return k;
         }
 
-        void doneRead(beast::error_code ec, size_t bytes_transferred)
+        // With 'lock' held:
+        void scheduleRefresh(const string& k)
+        {
+            const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(ttl).count() * 4 / 5;
+            director.submitTask(ms, SharedPtr<std::function<void()>>(std::make_shared<std::function<void()>>([this, k] { refresh(k); })));
+        }
+
+        void refresh(const string& k)
         {
-            boost::ignore_unused(bytes_transferred);
-            
-            if (ec)
             {
-                Debug::print(Debug::Level::warning, REMOVED("TcpConnection::doneRead(): "), ec.message().c_str());
-                // reset & close:
-                hostHash->store(0, std::memory_order_relaxed);
+                lock_guard<mutex> l(lock);
+                const auto it = entries.find(k);
+                if (it == entries.end())
+                    return;
+                if (it->second.used == false)
+                {
+                    entries.erase(it); // Nobody asked lately, the next connect resolves again
+                    return;
+                }
+                it->second.used = false;
+            }
+
+            const size_t colon = k.rfind(':');
+            resolver.async_resolve( k.substr(0, colon)
+                                  , k.substr(colon+1)
+                                  , [this, k](beast::error_code ec, Results results)
+                                    {
+                                        if (ec == asio::error::operation_aborted)
+                                            return;
+                                        if (ec)
+                                        {
+                                            // Keep handing out the old endpoints until they expire:
+                                            return Debug::print(Debug::Level::warning, REMOVED("DnsCache::refresh(): "), ec.message().c_str(), REMOVED(", host: "), k.c_str());
+                                        }
+                                        
+                                        lock_guard<mutex> l(lock);
+                                        Entry& entry = entries[k];
+                                        entry.results = std::move(results);
+                                        entry.ec = {};
+                                        entry.expires = Clock::now() + ttl;
+                                        scheduleRefresh(k);
+                                    }
+                                  );
+        }
+
+    public:
+        DnsCache(asio::io_context& ioc, const int ttlSecs, const int negativeSecs)
+          : resolver(ioc)
+          , director(ioc)
+          , ttl(ttlSecs)
+          , negativeTtl(negativeSecs)
+        {}
+
+        DnsCache(const DnsCache&) = delete;
+        DnsCache& operator=(const DnsCache&) = delete;
+
+        ~DnsCache()
+        {
+            director.shutdown();
+        }
+
+        // False: not cached, resolve. True: 'results' or 'ec' (negative entry) are set
+        bool lookup(string_view host, string_view port, Results& results, beast::error_code& ec)
+        {
+            lock_guard<mutex> l(lock);
+            const auto it = entries.find(key(host, port));
+            if (it == entries.end() || it->second.expires <= Clock::now())
+                return false;
+            it->second.used = true;
+            results = it->second.results;
+            ec = it->second.ec;
+            return true;
+        }
+
+        // 0 if we never raced this host:
+        int fastFamily(string_view host, string_view port)
+        {
+            lock_guard<mutex> l(lock);
+            const auto it = entries.find(key(host, port));
+            return it == entries.end() ? 0 : it->second.family;
+        }
+
+        void rememberFamily(string_view host, string_view port, const int family)
+        {
+            lock_guard<mutex> l(lock);
+            entries[key(host, port)].family = family; // Without results, lookup() still misses
+        }
+
+        void store(string_view host, string_view port, const beast::error_code ec, const Results& results)
+        {
+            if (ec == asio::error::operation_aborted || (ec ? negativeTtl : ttl).count() == 0)
+                return;
+
+            lock_guard<mutex> l(lock);
+            auto [it, inserted] = entries.try_emplace(key(host, port));
+            Entry& entry = it->second;
+            // A live entry already has its refresh scheduled:
+            const bool live = !inserted && !entry.ec && entry.expires > Clock::now();
+            entry.results = results;
+            entry.ec = ec;
+            entry.expires = Clock::now() + (ec ? negativeTtl : ttl);
+            if (!ec && !live)
+                scheduleRefresh(it->first);
+        }
+    };
+
+
+    /****************************************/
+    /*  Request waiting for busy connection */
+    /****************************************/
+    struct Done
+    {
+        Pool::Completion    fn   = nullptr;
+        void               *user = nullptr;
+        Pool::Sink          sink = nullptr;
+        bool                borrowsData = false; // The request body is the caller's until this fires
+
+        // Hand the reply to the caller's handler; false: caller polls getReply()
+        bool operator()(const int callerId, const int statusCode, const char *body, const int bodylen) const
+        {
+            if (sink)
+            {
+                sink(user, callerId, statusCode, body, bodylen, true);
+                return true;
+            }
+            if (fn == nullptr)
+                return false;
+            fn(user, callerId, statusCode, body, bodylen);
+            return true;
+        }
+
+        // Replies nobody asked for (keep-warm pings):
+        static void discard(void *, const int, const int, const char *, const int) {}
+    };
+
+    
+    /****************************************/
+    /*  Request waiting for busy connection */
+    /****************************************/
+    struct Pending
+    {
+        int             callerId;
+        string          url, data, auth, xApiKey;
+        Pool::Method    method;
+        Pool::Format    format;
+        Done            done;
+        string_view     borrowed = {}; // Instead of 'data' with done.borrowsData
+        const Pool::Prepared *prepared = nullptr; // Its header lines instead of the connection's
+
+        string_view body() const
+        {
+            return done.borrowsData ? borrowed : string_view(data);
+        }
+    };
+
+    
+    /****************************************/
+    /*                            getSock() */
+    /****************************************/
+    inline auto& getSock(beast::tcp_stream& sock)
+    {
+        return sock;
+    }
+    
+    inline auto& getSock(beast::ssl_stream<beast::tcp_stream>& sock)
+    {
+        return beast::get_lowest_layer(sock);
+    }
+            
+    
+    /****************************************/
+    /*                   Shared TLS context */
+    /*                                      */
+    /* One client context for every slot.   */
+    /* The newest session of each SNI host  */
+    /* is kept and offered on reconnect, so */
+    /* the server can skip the full         */
+    /* handshake.                           */
+    /****************************************/
+    class TlsClient
+    {
+    private:
+        asio::ssl::context ctx;
+
+        mutex lock;
+        
+        std::unordered_map<string, SSL_SESSION *> sessions; // One reference held per entry
+
+        // asio keeps its own callbacks in the app data, we need a slot of our own:
+        static int exIndex()
+        {
+            static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+            return index;
+        }
+
+        static int onNewSession(SSL *ssl, SSL_SESSION *session)
+        {
+            const char *host = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+            if (host == nullptr || SSL_SESSION_is_resumable(session) == 0)
+                return 0;
+
+            TlsClient *self = static_cast<TlsClient *>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), exIndex()));
+            // A copy: closing a connection without close_notify marks its own
+            // session as not resumable
+            SSL_SESSION *copy = SSL_SESSION_dup(session);
+            if (copy == nullptr)
+                return 0;
+
+            lock_guard<mutex> l(self->lock);
+            SSL_SESSION *& slot = self->sessions[host];
+            if (slot)
+                SSL_SESSION_free(slot);
+            slot = copy;
+            return 0; // OpenSSL keeps its reference to the original
+        }
+
+    public:
+        TlsClient()
+          : ctx(asio::ssl::context::tls_client)
+        {
+            SSL_CTX *native = ctx.native_handle();
+            SSL_CTX_set_min_proto_version(native, TLS1_2_VERSION);
+            SSL_CTX_set_ex_data(native, exIndex(), this);
+            // Clients never look sessions up by id, only through the callback:
+            SSL_CTX_set_session_cache_mode(native, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+            SSL_CTX_sess_set_new_cb(native, &TlsClient::onNewSession);
+        }
+
+        TlsClient(const TlsClient&) = delete;
+        TlsClient& operator=(const TlsClient&) = delete;
+
+        ~TlsClient()
+        {
+            for (auto& [host, session] : sessions)
+                SSL_SESSION_free(session);
+        }
+
+        asio::ssl::context& context() { return ctx; }
+
+        // SNI, and the last session for this host if we have one:
+        bool prepare(SSL *ssl, const string& host)
+        {
+            // Set SNI Hostname (many hosts need this to handshake successfully)
+            if (!SSL_set_tlsext_host_name(ssl, host.c_str()))
+            {
+                beast::error_code ec{ static_cast<int>(::ERR_get_error())
+                                    , boost::asio::error::get_ssl_category() 
+                                    };
+                Debug::print(Debug::Level::error, REMOVED("TlsClient::prepare(): "), ec.message().c_str());
+                return false;
+            }
+
+            lock_guard<mutex> l(lock);
+            if (const auto it = sessions.find(host); it != sessions.end())
+                SSL_set_session(ssl, it->second);
+            return true;
+        }
+
+        // After a failed handshake, don't offer that session again:
+        void forget(const string& host)
+        {
+            lock_guard<mutex> l(lock);
+            if (const auto it = sessions.find(host); it != sessions.end())
+            {
+                SSL_SESSION_free(it->second);
+                sessions.erase(it);
+            }
+        }
+    };
+
+
+    /****************************************/
+    /*           Warm SOCKS5 proxy sessions */
+    /*                                      */
+    /* Per shard: connections to the local  */
+    /* proxy that already did the method    */
+    /* negotiation, so a new destination    */
+    /* only pays for CONNECT.               */
+    /****************************************/
+    class SocksSpares
+    {
+    public:
+        using Socket = beast::tcp_stream::socket_type;
+        
+    private:
+        struct Proxy
+        {
+            unsigned short     port;
+            deque<Socket>      ready;
+            int                dialing = 0;
+        };
+
+        asio::io_context& ioContext;
+
+        const int keep;
+
+        mutex lock;
+
+        deque<Proxy> proxies; // Only a handful, one per proxy port in use
+
+        // With 'lock' held:
+        Proxy& find(const unsigned short port)
+        {
+            for (Proxy& proxy : proxies)
+                if (proxy.port == port)
+                    return proxy;
+            return proxies.emplace_back(Proxy{ port, {} });
+        }
+
+        // With 'lock' held:
+        void refill(Proxy& proxy)
+        {
+            while ((int)proxy.ready.size() + proxy.dialing < keep)
+            {
+                proxy.dialing += 1;
+                dial(proxy.port);
+            }
+        }
+
+        void dial(const unsigned short port)
+        {
+            struct Dial
+            {
+                beast::tcp_stream                 stream;
+                std::array<unsigned char, 3>      buf;
+            };
+            auto d = std::make_shared<Dial>(Dial{ beast::tcp_stream(make_strand(ioContext)), {} });
+
+            auto done = [this, d, port](const bool ok)
+                        {
+                            lock_guard<mutex> l(lock);
+                            Proxy& proxy = find(port);
+                            proxy.dialing -= 1;
+                            if (ok)
+                                proxy.ready.push_back(d->stream.release_socket());
+                        };
+
+            d->stream.expires_after(std::chrono::seconds(9));
+            d->stream.async_connect( asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), port)
+                                   , [d, done](beast::error_code ec)
+                                     {
+                                         if (ec)
+                                             return done(false);
+                                         d->buf = { 0x05   // socks5
+                                                  , 0x01   // One authentication method
+                                                  , 0x00   // No authentication
+                                                  };
+                                         asio::async_write( d->stream
+                                                          , asio::buffer(d->buf)
+                                                          , [d, done](beast::error_code ec2, size_t)
+                                                            {
+                                                                if (ec2)
+                                                                    return done(false);
+                                                                asio::async_read( d->stream
+                                                                                , asio::buffer(d->buf.data(), 2)
+                                                                                , [d, done](beast::error_code ec3, size_t)
+                                                                                  {
+                                                                                      d->stream.expires_never();
+                                                                                      done(!ec3 && d->buf[0] == 0x05 && d->buf[1] == 0x00);
+                                                                                  }
+                                                                                );
+                                                            }
+                                                          );
+                                     }
+                                   );
+        }
+
+        // The proxy may have dropped it while it sat here:
+        static bool alive(Socket& sock)
+        {
+            beast::error_code ec, peeked;
+            char probe;
+            sock.non_blocking(true, ec);
+            sock.receive(asio::buffer(&probe, 1), asio::socket_base::message_peek, peeked);
+            sock.non_blocking(false, ec);
+            return peeked == asio::error::would_block;
+        }
+
+    public:
+        SocksSpares(asio::io_context& ioCtx, const int n)
+          : ioContext(ioCtx)
+          , keep(n)
+        {}
+
+        SocksSpares(const SocksSpares&) = delete;
+        SocksSpares& operator=(const SocksSpares&) = delete;
+
+        // True: 'sock' is connected to the proxy and past the greeting
+        bool take(const unsigned short port, Socket& sock)
+        {
+            if (keep == 0)
+                return false;
+            
+            lock_guard<mutex> l(lock);
+            Proxy& proxy = find(port);
+            bool found = false;
+            while (proxy.ready.empty() == false && found == false)
+            {
+                if (alive(proxy.ready.front()))
+                {
+                    sock = std::move(proxy.ready.front());
+                    found = true;
+                }
+                proxy.ready.pop_front();
+            }
+            refill(proxy);
+            return found;
+        }
+    };
+
+
+    /****************************************/
+    /*                  Interned host table */
+    /*                                      */
+    /* Per shard and slot type. A host's id */
+    /* leads straight to the slots bound to */
+    /* it, unbound slots wait on a free     */
+    /* list. Hits compare the whole name,   */
+    /* colliding hashes are told apart.     */
+    /*                                      */
+    /* Names are "[user:pw@]host[:port]":   */
+    /* a connection carries its user's      */
+    /* Basic auth, other users get their    */
+    /* own connections to the host.         */
+    /*                                      */
+    /* Connections only flip their 'hostId' */
+    /* to 0 when they drop (on any thread), */
+    /* the table catches up on its own.     */
+    /****************************************/
+    class HostTable
+    {
+    private:
+        struct Host
+        {
+            string          name;
+            u64             hash = 0;
+            bool            live = false;
+            vector<int>     slots;     // Bound to this host, some may have dropped since
+        };
+
+        vector<Host>        hosts;     // By id-1
+        vector<u32>         unusedIds;
+        int                 live = 0;
+
+        vector<u32>         index;     // Linear probing on the hash, 0: empty
+        u32                 mask;
+
+        vector<int>         freeSlots;
+
+        // High bits, the low ones picked the shard (hash % shards) and are alike here:
+        static u32 bucket(const u64 hash)
+        {
+            return (u32)(hash >> 32);
+        }
+
+        void place(const u32 id)
+        {
+            u32 i = bucket(hosts[id-1].hash) & mask;
+            while (index[i] != 0)
+                i = (i+1) & mask;
+            index[i] = id;
+        }
+
+        void grow()
+        {
+            index.assign(index.size()*2, 0);
+            mask = (u32)index.size() - 1;
+            for (u32 id=1; id<=(u32)hosts.size(); ++id)
+                if (hosts[id-1].live)
+                    place(id);
+        }
+
+        // Backward shift, the probe chains stay intact without tombstones:
+        void erase(const u32 id)
+        {
+            u32 hole = bucket(hosts[id-1].hash) & mask;
+            while (index[hole] != id)
+                hole = (hole+1) & mask;
+
+            for (u32 j=(hole+1) & mask; index[j] != 0; j=(j+1) & mask)
+            {
+                const u32 home = bucket(hosts[index[j]-1].hash) & mask;
+                if (((j - home) & mask) >= ((j - hole) & mask))
+                {
+                    index[hole] = index[j];
+                    hole = j;
+                }
+            }
+            index[hole] = 0;
+
+            Host& host = hosts[id-1];
+            host.live = false;
+            host.name.clear();
+            host.slots.clear();
+            unusedIds.push_back(id);
+            live -= 1;
+        }
+
+        // Drops the slots that disconnected since, they become free:
+        template <class Slots>
+        void prune(Slots& slots, const u32 id)
+        {
+            vector<int>& bound = hosts[id-1].slots;
+            for (size_t i=0; i<bound.size();)
+            {
+                if (slots[bound[i]].hostId->load(std::memory_order_relaxed) == id)
+                {
+                    ++i;
+                    continue;
+                }
+                freeSlots.push_back(bound[i]);
+                bound[i] = bound.back();
+                bound.pop_back();
+            }
+        }
+
+        template <class Slots>
+        void sweep(Slots& slots)
+        {
+            for (u32 id=1; id<=(u32)hosts.size(); ++id)
+            {
+                if (hosts[id-1].live == false)
+                    continue;
+                prune(slots, id);
+                if (hosts[id-1].slots.empty())
+                    erase(id);
+            }
+        }
+
+    public:
+        // Bumped by connections as they disconnect:
+        std::atomic<u32>    released{0};
+
+        HostTable()
+          : index(16, 0)
+          , mask(15)
+        {}
+
+        HostTable(const HostTable&) = delete;
+        HostTable& operator=(const HostTable&) = delete;
+
+        // 0: not interned
+        u32 find(string_view name, const u64 hash) const
+        {
+            for (u32 i=bucket(hash) & mask; index[i] != 0; i=(i+1) & mask)
+            {
+                const Host& host = hosts[index[i]-1];
+                if (host.hash == hash && host.name == name)
+                    return index[i];
+            }
+            return 0;
+        }
+
+        template <class Slots>
+        u32 intern(Slots& slots, string_view name, const u64 hash)
+        {
+            if (const u32 id = find(name, hash))
+                return id;
+
+            // Load factor stays below 1/2, hosts nobody is connected to go first:
+            if ((live+1)*2 > (int)index.size())
+                sweep(slots);
+            if ((live+1)*2 > (int)index.size())
+                grow();
+
+            u32 id;
+            if (unusedIds.empty() == false)
+            {
+                id = unusedIds.back();
+                unusedIds.pop_back();
+            }
+            else
+            {
+                hosts.emplace_back();
+                id = (u32)hosts.size();
+            }
+
+            Host& host = hosts[id-1];
+            host.name = name;
+            host.hash = hash;
+            host.live = true;
+            place(id);
+            live += 1;
+            return id;
+        }
+
+        // Slots still connected to host 'id':
+        template <class Slots>
+        const vector<int>& slotsOf(Slots& slots, const u32 id)
+        {
+            prune(slots, id);
+            return hosts[id-1].slots;
+        }
+
+        template <class Slots>
+        void bind(Slots& slots, const int slot, const u32 id)
+        {
+            slots[slot].hostId->store(id, std::memory_order_relaxed);
+            hosts[id-1].slots.push_back(slot);
+        }
+
+        void addFree(const int slot)
+        {
+            freeSlots.push_back(slot);
+        }
+
+        // -1: none free
+        template <class Slots>
+        int takeFree(Slots& slots)
+        {
+            if (freeSlots.empty() && released.exchange(0, std::memory_order_relaxed) > 0)
+                sweep(slots);
+            if (freeSlots.empty())
+                return -1;
+            const int slot = freeSlots.back();
+            freeSlots.pop_back();
+            return slot;
+        }
+    };
+
+
+    /****************************************/
+    /*                 Timings and counters */
+    /*                                      */
+    /* Relaxed atomics: bumped on the io    */
+    /* threads, read by Pool::stats() from  */
+    /* anywhere. A connection looks up its  */
+    /* host's timings once per connect.     */
+    /****************************************/
+    struct HostTimes
+    {
+        struct Histogram
+        {
+            std::atomic<u64> buckets[Pool::histogramBuckets] = {};
+            std::atomic<u64> sumMicros = 0;
+        };
+        Histogram phases[Pool::phaseCount];
+
+        void add(const Pool::Phase phase, const std::chrono::steady_clock::duration d)
+        {
+            const u64 micros = (u64)std::max<i64>(std::chrono::duration_cast<std::chrono::microseconds>(d).count(), 0);
+            const int bucket = std::min(std::max((int)std::bit_width(micros) - 1, 0), Pool::histogramBuckets - 1);
+            Histogram& h = phases[(int)phase];
+            h.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+            h.sumMicros.fetch_add(micros, std::memory_order_relaxed);
+        }
+    };
+
+    class Metrics
+    {
+    private:
+        // Beyond that many hosts the rest share one entry:
+        static constexpr size_t maxHosts = 1024;
+        
+        mutable mutex                                    lock;
+        std::unordered_map<string, unique_ptr<HostTimes>> hosts;
+        HostTimes                                        others;
+
+    public:
+        std::atomic<i64>    requests = 0, reuses = 0, connects = 0, reconnects = 0, socksSpares = 0, drops = 0, busyRejections = 0, exhausted = 0;
+        std::atomic<int>    connected = 0;
+        std::atomic_int&    globalConnected; // Global::nCurrentConnected, all pools together
+
+        explicit Metrics(std::atomic_int& global)
+          : globalConnected(global)
+        {}
+
+        Metrics(const Metrics&) = delete;
+        Metrics& operator=(const Metrics&) = delete;
+
+        ~Metrics()
+        {
+            globalConnected.fetch_sub(connected.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+
+        HostTimes *times(const string& host)
+        {
+            const lock_guard<mutex> l(lock);
+            if (const auto it = hosts.find(host); it != hosts.end())
+                return it->second.get();
+            if (hosts.size() >= maxHosts)
+                return &others;
+            return hosts.emplace(host, make_unique<HostTimes>()).first->second.get();
+        }
+
+        void opened()
+        {
+            connects.fetch_add(1, std::memory_order_relaxed);
+            connected.fetch_add(1, std::memory_order_relaxed);
+            globalConnected.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void closed()
+        {
+            connected.fetch_sub(1, std::memory_order_relaxed);
+            globalConnected.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        static void copy(const HostTimes& from, Pool::HostStats& to)
+        {
+            for (int p=0; p<Pool::phaseCount; ++p)
+            {
+                Pool::Histogram& h = to.phases[p];
+                h = Pool::Histogram();
+                for (int b=0; b<Pool::histogramBuckets; ++b)
+                {
+                    h.buckets[b] = (long long)from.phases[p].buckets[b].load(std::memory_order_relaxed);
+                    h.count += h.buckets[b];
+                }
+                h.sumMicros = (long long)from.phases[p].sumMicros.load(std::memory_order_relaxed);
+            }
+        }
+
+        Pool::Stats snapshot(Pool::HostStats *out, const int maxOut) const
+        {
+            Pool::Stats s;
+            s.requests       = requests.load(std::memory_order_relaxed);
+            s.reuses         = reuses.load(std::memory_order_relaxed);
+            s.connects       = connects.load(std::memory_order_relaxed);
+            s.reconnects     = reconnects.load(std::memory_order_relaxed);
+            s.socksSpares    = socksSpares.load(std::memory_order_relaxed);
+            s.drops          = drops.load(std::memory_order_relaxed);
+            s.busyRejections = busyRejections.load(std::memory_order_relaxed);
+            s.exhausted      = exhausted.load(std::memory_order_relaxed);
+            s.connected      = connected.load(std::memory_order_relaxed);
+
+            const lock_guard<mutex> l(lock);
+            s.hosts = (int)hosts.size() + (hosts.size() >= maxHosts ? 1 : 0);
+            int n = 0;
+            for (const auto& [host, times] : hosts)
+            {
+                if (n >= maxOut)
+                    break;
+                const size_t len = host.copy(out[n].host, sizeof(out[n].host) - 1);
+                out[n].host[len] = '\0';
+                copy(*times, out[n++]);
+            }
+            if (n < maxOut && hosts.size() >= maxHosts)
+            {
+                out[n].host[0] = '*';
+                out[n].host[1] = '\0';
+                copy(others, out[n]);
+            }
+            return s;
+        }
+    };
+
+
+    /****************************************/
+    /*                              TLS/SSL */
+    /****************************************/
+    struct SSL_on
+    {
+        TlsClient& tls;
+        
+        static constexpr bool DoSSL = true;
+        
+        explicit SSL_on(TlsClient& t)
+          : tls(t)
+        {}
+    };
+        
+    
+    struct SSL_off
+    {
+        static constexpr bool DoSSL = false;
+
+        explicit SSL_off(TlsClient&)
+        {}
+    };
+
+
+    /****************************************/
+    /*     Bump allocator for reply headers */
+    /****************************************/
+    struct HeaderArena
+    {
+        static constexpr size_t size = 4096;
+        
+        unique_ptr<char[]> mem = std::make_unique<char[]>(size);
+        size_t used = 0;
+
+        // Only once the parser using it is gone:
+        void rewind() { used = 0; }
+    };
+
+    template <class T>
+    struct ArenaAllocator
+    {
+        using value_type = T;
+        
+        HeaderArena *arena;
+
+        explicit ArenaAllocator(HeaderArena *a) noexcept : arena(a) {}
+
+        template <class U>
+        ArenaAllocator(const ArenaAllocator<U>& other) noexcept : arena(other.arena) {}
+
+        T *allocate(const size_t n)
+        {
+            const size_t at = (arena->used + alignof(T) - 1) & ~(alignof(T) - 1);
+            if (at + n*sizeof(T) > HeaderArena::size)
+                return static_cast<T *>(::operator new(n*sizeof(T))); // Unusually large header
+            arena->used = at + n*sizeof(T);
+            return reinterpret_cast<T *>(arena->mem.get() + at);
+        }
+
+        void deallocate(T *p, const size_t n) noexcept
+        {
+            const char *c = reinterpret_cast<const char *>(p);
+            if (c < arena->mem.get() || c >= arena->mem.get() + HeaderArena::size)
+                ::operator delete(p, n*sizeof(T));
+        }
+
+        template <class U>
+        bool operator==(const ArenaAllocator<U>& other) const noexcept { return arena == other.arena; }
+    };
+
+
+    /****************************************/
+    /*                Single Tcp Connection */
+    /****************************************/
+    template <class Sockettype, class SSL>
+    struct TcpConnection : public SSL
+    {  
+        unique_ptr<AtomicFlag> busy;
+
+        unique_ptr<std::atomic<u32>> hostId; // In the shard's HostTable, 0: not connected
+
+        unique_ptr<Sockettype> stream;
+
+        beast::flat_buffer buffer; // Must persist between reads
+
+        string host, userpw;
+
+        asio::ip::tcp::resolver resolver;
+
+        string hostField;   // As given, with the port
+        string headerBlock; // See cacheHeaders()
+        string headerHost, headerUserpw, headerAuth; // What headerBlock was made with
+        unique_ptr<HeaderArena> arena; // Header fields of both parsers, must outlive them
+
+        // Must be 'optional' to avoid 'double body' problem (boxed, parsers can't be moved):
+        using Parser = boost::beast::http::response_parser<boost::beast::http::string_body, ArenaAllocator<char>>;
+        unique_ptr<optional<Parser>> res; 
+
+        // Streamed responses: the body goes to the sink in pieces of 'chunkSize'
+        using StreamParser = boost::beast::http::response_parser<boost::beast::http::buffer_body, ArenaAllocator<char>>;
+        unique_ptr<optional<StreamParser>> streamRes;
+        static constexpr size_t chunkSize = 64*1024;
+        unique_ptr<char[]> chunk; // Allocated on first use
+
+        // Responses still owed to us, in the order the requests were written:
+        struct Expected
+        {
+            int     callerId;
+            bool    head;     // HEAD responses carry no body
+            Done    done;
+        };
+        deque<Expected> inflight;
+
+        int pipelineDepth;
+        std::uint64_t maxReplyBytes; // Pool::Limits::maxReplyBytes
+        deque<Pending> pipelined; // The requests of the last pipelined write, to send again if cut short
+
+        string out; // Serialized request(s), back to back when pipelining. Keeps its capacity
+
+        string_view borrowed; // Body of the request in 'out', still in the caller's buffer
+        
+        // SOCKS5 tunnel setup, one step per completion. The reply is at most
+        // 4 + 1+255 (BND.ADDR as a domain name) + 2 bytes:
+        enum class Socks { connected, greeted, method, requested, reply, bound };
+        Socks socksStep = Socks::connected;
+        unsigned short socksProxyPort = 0, socksDstPort = 0;
+        bool socksSpare = false; // Started from a warm proxy connection
+        std::array<unsigned char, 4+1+255+2> socksBuf;
+
+        int totalConsecutiveReads = 0;
+    
+        boost::asio::deadline_timer keepaliveTimer;
+
+        int idleTimeout; // seconds
+    
+        ReplyStore&                   replies;
+        BodyPool&                     bodies;
+        DnsCache&                     dns;
+        SocksSpares&                  spares;
+        HostTable&                    hostTable;
+        Metrics&                      metrics;
+
+        HostTimes                    *times = nullptr; // Of 'hostField', from establish() on
+        std::chrono::steady_clock::time_point phaseStart;
+        bool                          connected = false;
+        string                        lastHost;        // hostField of the previous connection
+
+        // Requests for this host that arrived while we were busy. Drained by
+        // doneRead() on the open socket; guarded by 'pendingLock' because
+        // submit() runs on the caller's thread:
+        unique_ptr<mutex>             pendingLock;
+        deque<Pending>                pending;
+
+        enum class Submit { sent, queued, full, gone };
+    
+        auto makeSock(asio::io_context& ioc) NON_CONST
+        {
+            if constexpr (this->DoSSL)
+                return make_unique<beast::ssl_stream<beast::tcp_stream>>(make_strand(ioc), this->tls.context());
+            else
+                return make_unique<beast::tcp_stream>(make_strand(ioc));
+        }
+
+        // Host, Connection and Authorization only change with the host or the
+        // credentials, they are serialized once and copied into every request:
+        void cacheHeaders(string_view auth)
+        {
+            headerBlock.clear();
+            headerBlock += PROTECTED("Host: ");
+            headerBlock += hostField;
+            headerBlock += PROTECTED("\r\nConnection: Keep-Alive\r\n");
+            if (userpw.empty() == false)
+            {
+                string login(base64encode_getRequiredSize(userpw.size()), '\0');
+                base64encode(login.data(), userpw.c_str(), userpw.size());
+                headerBlock += PROTECTED("Authorization: Basic "); // login:pass => base64
+                headerBlock += login;
+                headerBlock += PROTECTED("\r\n");
+            }
+            else if (auth.empty() == false)
+            {
+                headerBlock += PROTECTED("Authorization: ");
+                headerBlock += auth;
+                headerBlock += PROTECTED("\r\n");
+            }
+            headerHost = hostField;
+            headerUserpw = userpw;
+            headerAuth = auth;
+        }
+
+        // Appends the whole request to 'dst', only the request line, type,
+        // length and body are done per call:
+        void serializeRequest( string& dst
+                             , const Pool::Method method
+                             , string_view url
+                             , string_view data
+                             , string_view auth
+                             , string_view xApiKey
+                             , const Pool::Format format
+                             , const bool copyBody = true
+                             , const Pool::Prepared *prepared = nullptr
+                             )
+        {
+            static const string json = PROTECTED("Content-Type: application/json\r\n");
+            static constexpr string_view verbs[] = { "GET ", "POST ", "PUT ", "DELETE ", "HEAD " };
+
+            dst += verbs[(int)method];
+            dst += url;
+            dst += " HTTP/1.1\r\n";
+            // A prepared request brings its own lines, whoever opened the connection:
+            if (prepared != nullptr)
+                dst.append(prepared->headers, prepared->headersLen);
+            else
+            {
+                if (auth != headerAuth || userpw != headerUserpw || hostField != headerHost)
+                    cacheHeaders(auth);
+                dst += headerBlock;
+            }
+            if (format == Pool::Format::JSON)
+                dst += json;
+            // POST always has a length, others only with a body:
+            if (method == Pool::Method::POST || data.empty() == false)
+            {
+                char digits[24];
+                const auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), data.size());
+                dst += "Content-Length: ";
+                dst.append(digits, end);
+                dst += "\r\n";
+            }
+            dst += "\r\n";
+            if (copyBody)
+                dst += data;
+            //if (xApiKey.empty() == false)
+              //  X-Api-Key: xApiKey
+        }
+    
+        TcpConnection( asio::io_context& ioc
+                     , ReplyStore& r
+                     , BodyPool& b
+                     , DnsCache& d
+                     , TlsClient& t
+                     , SocksSpares& s
+                     , HostTable& h
+                     , Metrics& m
+                     , const int idleSecs = 60
+                     , const int depth = 1
+                     , const int maxReply = Pool::Limits().maxReplyBytes
+                     )
+          : SSL(t)
+          , busy(std::make_unique<AtomicFlag>())
+          , hostId(std::make_unique<std::atomic<u32>>(0))
+          , stream(makeSock(ioc))
+          , resolver(make_strand(ioc))
+          , arena(std::make_unique<HeaderArena>())
+          , res(std::make_unique<optional<Parser>>())
+          , streamRes(std::make_unique<optional<StreamParser>>())
+          , pipelineDepth(depth)
+          , maxReplyBytes((std::uint64_t)maxReply)
+          , keepaliveTimer(ioc)
+          , idleTimeout(idleSecs)
+          , replies(r)
+          , bodies(b)
+          , dns(d)
+          , spares(s)
+          , hostTable(h)
+          , metrics(m)
+          , pendingLock(std::make_unique<mutex>())
+        {
+            busy->makeAvail();
+        }
+        
+        template <bool ConnectSocks5>
+        void establish( const int caller
+                      , string_view newhost
+                      , string_view url
+                      , string_view data
+                      , string_view auth
+                      , string_view xApiKey
+                      , const Pool::Method method
+                      , const Pool::Format format
+                      , const unsigned short socks5port
+                      , const Done done
+                      , const bool warmOnly = false
+                      , const Pool::Prepared *prepared = nullptr)
+        {
+            // We remain busy for the whole operation:
+            const AtomicFlag::State isBusy = busy->isAvail_then_lock();
+            boost::ignore_unused(isBusy);
+
+            phaseStart = std::chrono::steady_clock::now();
+            socksProxyPort = ConnectSocks5 ? socks5port : 0;
+
+            // Nothing of the last connection carries over: writes it never saw
+            // answered, nor what was left unparsed after an error:
+            totalConsecutiveReads = 0;
+            buffer.clear();
+            pipelined.clear();
+        
+            // Pre-warming: connect (and handshake), then park without a request
+            if (warmOnly)
+                inflight.clear();
+            else
+                inflight.assign(1, Expected{ caller, method == Pool::Method::HEAD, done });
+
+            // Only for the request that came with it, anything queued after is parsed as usual:
+            if (prepared != nullptr)
+            {
+                userpw.assign(prepared->userpw, prepared->userpwLen);
+                host.assign(prepared->host, prepared->hostLen);
+            }
+            else if ( const auto userpwPos = newhost.find("@")
+                    ; userpwPos>0 && userpwPos<newhost.size()
+                    )
+            {
+                userpw = newhost.substr(0, userpwPos);
+                host = newhost.substr(userpwPos+1);
+            }
+            else
+            {
+                userpw.clear();
+                host = newhost;
+            }
+
+            if (hostField != host || times == nullptr)
+            {
+                hostField = host;
+                times = metrics.times(hostField);
+            }
+            if (prepared != nullptr)
+            {
+                headerBlock.assign(prepared->headers, prepared->headersLen);
+                headerHost = hostField;
+                headerUserpw = userpw;
+                headerAuth.assign(prepared->auth, prepared->authLen);
+            }
+            else
+                cacheHeaders(auth);
+
+            if (warmOnly == false)
+                prepareWrite(method, url, data, auth, xApiKey, format, done, prepared);
+        
+            string port;
+            if (prepared != nullptr)
+            {
+                port.assign(prepared->port, prepared->portLen);
+                host.assign(prepared->sni, prepared->sniLen);
+            }
+            else if ( const auto dblePoint = host.rfind(":")
+                    ; dblePoint>0 && dblePoint<host.size()
+                    )
+            {
+                port = host.substr(dblePoint+1);
+                host = host.substr(0, dblePoint);
+            }
+
+            if (port.empty())
+            {
+                if constexpr (this->DoSSL)
+                    port = PROTECTED("443");
+                else
+                    port = PROTECTED("80");
+            }
+
+            if constexpr (this->DoSSL)
+            {
+                if (this->tls.prepare(stream->native_handle(), host) == false)
+                    return abandon();
+            }
+
+            auto connect = [this, port](beast::error_code ec, asio::ip::tcp::resolver::results_type results)
+                           {
+                               if (ec)
+                               {
+                                   Debug::print(Debug::Level::warning, REMOVED("[]connect: "), ec.message().c_str(), REMOVED(", host: "), host.c_str());
+                                   return abandon();
+                               }
+    
+                               // "10 seconds seems excessive for most sites" news.ycombinator.com/item?it=25832283
+                               getSock(*this->stream).expires_after(std::chrono::seconds(9));
+
+                               if (results.size() > 1)
+                                   race(results, port);
+                               else if constexpr (this->DoSSL)
+                                   getSock(*this->stream).async_connect(results, beast::bind_front_handler(&TcpConnection::handshake, this));
+                               else
+                                   getSock(*this->stream).async_connect(results, beast::bind_front_handler(&TcpConnection::write, this));
+                           };
+
+            if constexpr (ConnectSocks5)
+            {
+                socks5(socks5port, port);
+            }
+            else
+            {
+                // Hosts we talk to constantly never wait for DNS:
+                DnsCache::Results cached;
+                beast::error_code cachedEc;
+                if (dns.lookup(host, port, cached, cachedEc))
+                {
+                    asio::post(getSock(*stream).get_executor(), [connect, cachedEc, cached] { connect(cachedEc, cached); });
+                }
+                else
+                {
+                    resolver.async_resolve( host
+                                          , port
+                                          , [this, connect, port](beast::error_code ec, DnsCache::Results results)
+                                            {
+                                                if (!ec)
+                                                    lap(Pool::Phase::DNS);
+                                                dns.store(host, port, ec, results);
+                                                connect(ec, results);
+                                            }
+                                          );
+                }
+            }
+    
+            boost::ignore_unused(connect, socks5port);
+        }
+
+        Submit submit( const int caller
+                     , string_view url
+                     , string_view data
+                     , string_view auth
+                     , string_view xApiKey
+                     , const Pool::Method method
+                     , const Pool::Format format
+                     , const Done done
+                     , const int maxQueued
+                     , const u32 id
+                     , const Pool::Prepared *prepared = nullptr
+                     )
+        {
+            // doneRead() only makes us available while holding 'pendingLock',
+            // so a request can't slip into the queue after the last drain:
+            std::unique_lock<mutex> lock(*pendingLock);
+
+            // Closed since the caller picked us (idle timeout, server close):
+            if (hostId->load(std::memory_order_relaxed) != id)
+                return Submit::gone;
+
+            // Ours now. Sent without the lock, a failing send abandon()s, which takes it:
+            if (busy->isAvail_then_lock() == AtomicFlag::State::avail_but_no_more)
+            {
+                lock.unlock();
+                nextRequest(caller, url, data, auth, xApiKey, method, format, done, prepared);
+                return Submit::sent;
+            }
+
+            if ((int)pending.size() >= maxQueued)
+                return Submit::full;
+
+            if (done.borrowsData)
+                pending.push_back(Pending{ caller, string(url), string(), string(auth), string(xApiKey), method, format, done, data, prepared });
+            else
+                pending.push_back(Pending{ caller, string(url), string(data), string(auth), string(xApiKey), method, format, done, {}, prepared });
+            return Submit::queued;
+        }
+
+        int queued() const
+        {
+            const lock_guard<mutex> lock(*pendingLock);
+            return (int)pending.size();
+        }
+
+        // The slot goes back to the pool:
+        void unbind()
+        {
+            if (hostId->exchange(0, std::memory_order_relaxed) != 0)
+                hostTable.released.fetch_add(1, std::memory_order_relaxed);
+            closed();
+        }
+
+        // Connection lost: fail everything still waiting on it, and give the slot
+        // back. Always the last step, with the stream already replaced: from the
+        // unbind on, a caller thread or a Completion may take this very slot.
+        void abandon()
+        {
+            metrics.drops.fetch_add(1, std::memory_order_relaxed);
+            deque<Expected> failed;
+            failed.swap(inflight);
+            deque<Pending> dropped;
+            {
+                // Under 'pendingLock', so nothing can queue here in between:
+                const lock_guard<mutex> lock(*pendingLock);
+                dropped.swap(pending);
+                unbind();
+            }
+            for (const Expected& e : failed)
+                e.done(e.callerId, 999, nullptr, 0);
+            if (dropped.empty() == false)
+                Debug::print(Debug::Level::warning, REMOVED("TcpConnection::abandon(): "), (int)dropped.size());
+            for (const Pending& p : dropped)
+                p.done(p.callerId, 999, nullptr, 0);
+        }
+
+        // Happy eyeballs (RFC 8305). Attempts start 250 ms apart, or at once when the previous one failed.
+        // The first socket to connect wins, the others are closed:
+        struct Race
+        {
+            vector<asio::ip::tcp::endpoint>             order;
+            vector<unique_ptr<asio::ip::tcp::socket>>   sockets;
+            asio::steady_timer                          timer;
+            std::chrono::steady_clock::time_point       deadline;
+            string                                      port;
+            size_t                                      started = 0;
+            int                                         running = 0;
+            bool                                        over = false;
+
+            explicit Race(const asio::any_io_executor& ex)
+              : timer(ex)
+            {}
+        };
+
+        static constexpr auto connectStagger = std::chrono::milliseconds(250);
+
+        void race(const asio::ip::tcp::resolver::results_type& results, const string& port)
+        {
+            auto r = std::make_shared<Race>(getSock(*stream).get_executor());
+            r->deadline = std::chrono::steady_clock::now() + std::chrono::seconds(9);
+            r->port = port;
+
+            // Interleave the families, starting with the one that won last time (else IPv6):
+            vector<asio::ip::tcp::endpoint> v6, v4;
+            for (const auto& entry : results)
+                (entry.endpoint().address().is_v6() ? v6 : v4).push_back(entry.endpoint());
+            const bool v4First = dns.fastFamily(host, port) == 4;
+            vector<asio::ip::tcp::endpoint>& first  = v4First ? v4 : v6;
+            vector<asio::ip::tcp::endpoint>& second = v4First ? v6 : v4;
+            for (size_t i=0; i<std::max(first.size(), second.size()); ++i)
+            {
+                if (i < first.size())
+                    r->order.push_back(first[i]);
+                if (i < second.size())
+                    r->order.push_back(second[i]);
+            }
+
+            raceNext(r);
+        }
+
+        void raceNext(const std::shared_ptr<Race>& r)
+        {
+            if (r->over)
+                return;
+
+            if (r->started < r->order.size())
+            {
+                const size_t i = r->started++;
+                r->running += 1;
+                asio::ip::tcp::socket *sock = r->sockets.emplace_back(make_unique<asio::ip::tcp::socket>(getSock(*stream).get_executor())).get();
+                sock->async_connect(r->order[i], [this, r, sock, i](beast::error_code ec) { raceDone(r, sock, i, ec); });
+            }
+
+            // Next attempt after the stagger, once all are out only the deadline is left:
+            const auto now = std::chrono::steady_clock::now();
+            r->timer.expires_at(r->started < r->order.size() ? std::min(now + connectStagger, r->deadline) : r->deadline);
+            r->timer.async_wait([this, r](beast::error_code ec)
+                                {
+                                    if (ec == asio::error::operation_aborted || r->over)
+                                        return;
+                                    if (r->started < r->order.size() && std::chrono::steady_clock::now() < r->deadline)
+                                        return raceNext(r);
+                                    raceEnd(r, beast::error::timeout);
+                                }
+                               );
+        }
+
+        void raceDone(const std::shared_ptr<Race>& r, asio::ip::tcp::socket *sock, const size_t i, beast::error_code ec)
+        {
+            r->running -= 1;
+            if (r->over)
+                return;
+
+            if (ec)
+            {
+                if (r->started < r->order.size())
+                    return raceNext(r); // Don't wait out the stagger
+                if (r->running == 0)
+                    raceEnd(r, ec);
+                return;
+            }
+
+            r->over = true;
+            r->timer.cancel();
+            for (auto& other : r->sockets)
+                if (other.get() != sock)
+                    other->close(ec);
+
+            dns.rememberFamily(host, r->port, r->order[i].address().is_v6() ? 6 : 4);
+            getSock(*stream).socket() = std::move(*sock);
+            
+            if constexpr (this->DoSSL)
+                handshake({}, r->order[i]);
+            else
+                write({}, r->order[i]);
+        }
+
+        void raceEnd(const std::shared_ptr<Race>& r, const beast::error_code ec)
+        {
+            r->over = true;
+            r->timer.cancel();
+            beast::error_code ignored;
+            for (auto& sock : r->sockets)
+                sock->close(ignored);
+            Debug::print(Debug::Level::warning, REMOVED("TcpConnection::race(): "), ec.message().c_str(), REMOVED(", host: "), host.c_str());
+            writeSSL(ec); // Fails the request and frees the slot
+        }
+
+        // TCP (or the SOCKS5 tunnel) is up:
+        void opened()
+        {
+            lap(Pool::Phase::CONNECT);
+            connected = true;
+            metrics.opened();
+            if (hostField == lastHost)
+                metrics.reconnects.fetch_add(1, std::memory_order_relaxed);
+            else
+                lastHost = hostField;
+        }
+
+        void closed()
+        {
+            if (connected)
+                metrics.closed();
+            connected = false;
+        }
+
+        // Time since the last lap goes to 'phase' of the host:
+        void lap(const Pool::Phase phase)
+        {
+            const auto now = std::chrono::steady_clock::now();
+            if (times)
+                times->add(phase, now - phaseStart);
+            phaseStart = now;
+        }
+
+        void handshake(beast::error_code ec, asio::ip::tcp::resolver::endpoint_type)
+        {
+            if (ec)
+                return writeSSL(ec);
+
+            opened();
+            
+            if constexpr (this->DoSSL)
+                stream->async_handshake( asio::ssl::stream_base::handshake_type::client
+                                       , beast::bind_front_handler(&TcpConnection::writeSSL, this)
+                                       );
+        }
+    
+        // more detailed impl.: github.com/sehe/asio-socks45-client/blob/main/socks5.hpp
+        // develop.socks-proto.cpp.al/socks/quick_look/async_client0.html
+        void socks5(const unsigned short proxyPort, const string& dstPort)
+        {
+            int parsed = 0;
+            const auto [end, err] = std::from_chars(dstPort.data(), dstPort.data() + dstPort.size(), parsed);
+            if (err != std::errc() || end != dstPort.data() + dstPort.size() || parsed <= 0 || parsed > 0xffff || host.size() > 255)
+                return socksFail(REMOVED("bad destination"));
+            socksDstPort = (unsigned short)parsed;
+            socksProxyPort = proxyPort;
+
+            // One deadline for the whole exchange, a stuck proxy can't hold the slot:
+            getSock(*stream).expires_after(std::chrono::seconds(9));
+
+            socksSpare = spares.take(proxyPort, getSock(*stream).socket());
+            if (socksSpare)
+            {
+                metrics.socksSpares.fetch_add(1, std::memory_order_relaxed);
+                // Greeting is done already, straight to CONNECT:
+                socksStep = Socks::method;
+                socksBuf[0] = 0x05;
+                socksBuf[1] = 0x00;
+                return socks5Step({}, 0);
+            }
+
+            socks5Dial();
+        }
+
+        void socks5Dial()
+        {
+            socksStep = Socks::connected;
+            getSock(*stream).async_connect( asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), socksProxyPort)
+                                          , [this](beast::error_code ec) { socks5Step(ec, 0); }
+                                          );
+        }
+
+        void socks5Step(beast::error_code ec, size_t)
+        {
+            if (ec && socksSpare && ec != beast::error::timeout)
+            {
+                // The proxy dropped the spare in the meantime, once more on a fresh connection:
+                Debug::print(trace, REMOVED("TcpConnection::socks5Step(): stale spare, "), ec.message().c_str());
+                socksSpare = false;
+                getSock(*stream).socket().close(ec);
+                return socks5Dial();
+            }
+            
+            if (ec)
+                return socksFail(ec.message().c_str());
+
+            auto& sock = getSock(*stream);
+            
+            switch (socksStep)
+            {
+                case Socks::connected:
+                    socksBuf[0] = 0x05; // socks5
+                    socksBuf[1] = 0x01; // One authentication method
+                    socksBuf[2] = 0x00; // No authentication
+                    socksStep = Socks::greeted;
+                    return asio::async_write(sock, asio::buffer(socksBuf.data(), 3), beast::bind_front_handler(&TcpConnection::socks5Step, this));
+
+                case Socks::greeted:
+                    socksStep = Socks::method;
+                    return asio::async_read(sock, asio::buffer(socksBuf.data(), 2), beast::bind_front_handler(&TcpConnection::socks5Step, this));
+
+                case Socks::method:
+                {
+                    if (socksBuf[0] != 0x05 || socksBuf[1] != 0x00)
+                        return socksFail(REMOVED("auth error "), socksBuf[1]);
+
+                    size_t n = 0;
+                    socksBuf[n++] = 0x05; // socks 5
+                    socksBuf[n++] = 0x01; // connect
+                    socksBuf[n++] = 0x00; // reserved
+                    socksBuf[n++] = 0x03; // "domain"
+                    socksBuf[n++] = (unsigned char)host.size();
+                    n += host.copy((char *)socksBuf.data() + n, host.size());
+                    socksBuf[n++] = (unsigned char)(socksDstPort >> 8);
+                    socksBuf[n++] = (unsigned char)(socksDstPort & 255);
+                    socksStep = Socks::requested;
+                    return asio::async_write(sock, asio::buffer(socksBuf.data(), n), beast::bind_front_handler(&TcpConnection::socks5Step, this));
+                }
+
+                case Socks::requested:
+                    // VER REP RSV ATYP and the first byte of BND.ADDR, which is
+                    // the length if the proxy answers with a domain name:
+                    socksStep = Socks::reply;
+                    return asio::async_read(sock, asio::buffer(socksBuf.data(), 5), beast::bind_front_handler(&TcpConnection::socks5Step, this));
+
+                case Socks::reply:
+                {
+                    if (socksBuf[0] != 0x05 || socksBuf[1] != 0x00)
+                        return socksFail(REMOVED("socks5 error: "), socksBuf[1]);
+
+                    size_t rest = 0; // Remaining BND.ADDR + BND.PORT
+                    switch (socksBuf[3])
+                    {
+                        case 0x01: rest = 4-1 + 2;            break; // IPv4
+                        case 0x03: rest = socksBuf[4] + 2;    break; // Domain name
+                        case 0x04: rest = 16-1 + 2;           break; // IPv6
+                        default:
+                            return socksFail(REMOVED("bad address type "), socksBuf[3]);
+                    }
+                    socksStep = Socks::bound;
+                    return asio::async_read(sock, asio::buffer(socksBuf.data() + 5, rest), beast::bind_front_handler(&TcpConnection::socks5Step, this));
+                }
+
+                case Socks::bound:
+                    // Tunnel is up, from here on it's the plain connect path:
+                    if constexpr (this->DoSSL)
+                        return handshake(ec, {});
+                    else
+                        return writeSSL(ec);
+            }
+        }
+
+        void socksFail(const char *what, const int code = -1)
+        {
+            if (code < 0)
+                Debug::print(Debug::Level::warning, REMOVED("TcpConnection::socks5(): "), what);
+            else
+                Debug::print(Debug::Level::warning, REMOVED("TcpConnection::socks5(): "), what, code);
+            renewStream();
+            abandon();
+        }
+
+        void nextRequest( const int caller
+                        , string_view url
+                        , string_view data
+                        , string_view auth
+                        , string_view xApiKey
+                        , const Pool::Method method
+                        , const Pool::Format format
+                        , const Done done
+                        , const Pool::Prepared *prepared = nullptr
+                        )
+        {
+            // Don't let the idle timer close the socket under an active request:
+            keepaliveTimer.cancel();
+
+            metrics.reuses.fetch_add(1, std::memory_order_relaxed);
+            phaseStart = std::chrono::steady_clock::now();
+    
+            inflight.assign(1, Expected{ caller, method == Pool::Method::HEAD, done });
+
+            prepareWrite(method, url, data, auth, xApiKey, format, done, prepared);
+            
+            getSock(*stream).expires_after(std::chrono::seconds(30));
+    
+            if (getSock(*stream).socket().is_open() == false)
+            {
+                abandon();
+                return Debug::print(Debug::Level::warning, REMOVED("TcpConnection::nextRequest(): sock already closed"));
+            }
+                
+            sendRequest();
+        }
+
+        void prepareWrite( const Pool::Method method
+                         , string_view url
+                         , string_view data
+                         , string_view auth
+                         , string_view xApiKey
+                         , const Pool::Format format
+                         , const Done& done
+                         , const Pool::Prepared *prepared = nullptr
+                         )
+        {
+            out.clear();
+            serializeRequest(out, method, url, data, auth, xApiKey, format, done.borrowsData == false, prepared);
+            borrowed = done.borrowsData ? data : string_view();
+        }
+
+        // Head and a borrowed body leave in one vectored write, the body is never copied.
+        // (Not a std::array: asio's overload for two buffers stops after the first one on ssl_stream)
+        void sendRequest()
+        {
+            asio::async_write( *stream
+                             , beast::buffers_cat(asio::buffer(out), asio::buffer(borrowed.data(), borrowed.size()))
+                             , beast::bind_front_handler(&TcpConnection::read, this)
+                             );
+        }
+
+        static bool isPipelinable(const Pool::Method method)
+        {
+            return method == Pool::Method::GET || method == Pool::Method::HEAD;
+        }
+
+        void nextRequestsPipelined()
+        {
+            keepaliveTimer.cancel();
+
+            metrics.reuses.fetch_add((i64)pipelined.size(), std::memory_order_relaxed);
+            phaseStart = std::chrono::steady_clock::now();
+
+            inflight.clear();
+
+            out.clear();
+            borrowed = {}; // GET/HEAD only, a body is rare enough to be copied
+            for (const Pending& p : pipelined)
+            {
+                serializeRequest(out, p.method, p.url, p.body(), p.auth, p.xApiKey, p.format, true, p.prepared);
+                inflight.push_back(Expected{ p.callerId, p.method == Pool::Method::HEAD, p.done });
+            }
+
+            getSock(*stream).expires_after(std::chrono::seconds(30));
+
+            if (getSock(*stream).socket().is_open() == false)
+            {
+                abandon();
+                return Debug::print(Debug::Level::warning, REMOVED("TcpConnection::nextRequestsPipelined(): sock already closed"));
+            }
+
+            // All requests leave in one write, responses come back in the same order:
+            sendRequest();
+        }
+
+        void write(beast::error_code ec, asio::ip::tcp::resolver::endpoint_type)
+        {
+            return writeSSL(ec);
+        }
+
+        void writeSSL(beast::error_code ec)
+        {
+            if (ec)
+            {
+                Debug::print(Debug::Level::warning, REMOVED("TcpConnection::connect(): "), ec.message().c_str());
+                getSock(*stream).socket().shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+                if constexpr (this->DoSSL)
+                {
+                    // A stream that failed its handshake can't be used again:
+                    this->tls.forget(host);
+                    renewStream();
+                }
+                return abandon();
+            }
+
+            if constexpr (this->DoSSL)
+                lap(Pool::Phase::HANDSHAKE);
+            else
+                opened();
+
+            // Pre-warmed, nothing to send yet (unless requests queued up meanwhile):
+            if (inflight.empty())
+            {
+                getSock(*stream).expires_never();
+                return afterResponse(true);
+            }
+    
+            getSock(*stream).expires_after(std::chrono::seconds(30));
+    
+            sendRequest();
+        }
+
+        void read(beast::error_code ec, size_t bytes_transferred)
+        {
+            // Only what was sent so far, request bodies have no size limit (replies are
+            // capped by the parser's body_limit):
+            boost::ignore_unused(bytes_transferred);
+            totalConsecutiveReads += 1;
+
+            static constexpr int maxConsecutiveReads = 16;
+
+            if (totalConsecutiveReads > maxConsecutiveReads)
+                Debug::print(Debug::Level::warning, REMOVED("TcpConnection::read(): maxreads exceeded "), totalConsecutiveReads);
+            else if (ec)
+                Debug::print(Debug::Level::warning, REMOVED("TcpConnection::read(): "), ec.message().c_str());
+        
+            if (ec || totalConsecutiveReads > maxConsecutiveReads)
+            {
+                // reset & close, whoever waits gets 999:
+                getSock(*stream).socket().shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+                renewStream();
+                return abandon();
+            }
+
+            lap(Pool::Phase::WRITE);
+
+            readResponse();
+        }
+
+        void readResponse()
+        {
+            if (inflight.front().done.sink)
+                return readStreamHeader();
+            
+            res->reset();
+            streamRes->reset(); // Shares 'arena'
+            arena->rewind();
+            res->emplace( std::piecewise_construct
+                        , std::make_tuple()
+                        , std::make_tuple(ArenaAllocator<char>(arena.get()))
+                        );
+            // Parse straight into a recycled buffer. A longer body fails the read
+            // (http::error::body_limit), the request gets 999:
+            (*res)->get().body() = bodies.acquire();
+            (*res)->body_limit(maxReplyBytes);
+            if (inflight.front().head)
+                (*res)->skip(true);
+            
+            // Header first, to know the time to the first byte:
+            beast::http::async_read_header(*stream, buffer, **res, beast::bind_front_handler(&TcpConnection::doneReadHeader, this));
+        }
+
+        void doneReadHeader(beast::error_code ec, size_t bytes_transferred)
+        {
+            if (ec)
+                return doneRead(ec, bytes_transferred);
+
+            lap(Pool::Phase::FIRST_BYTE);
+
+            if ((*res)->is_done())
+                return doneRead(ec, 0);
+            beast::http::async_read(*stream, buffer, **res, beast::bind_front_handler(&TcpConnection::doneRead, this));
+        }
+
+        void doneRead(beast::error_code ec, size_t bytes_transferred)
+        {
+            boost::ignore_unused(bytes_transferred);
+            
+            if (ec)
+            {
+                Debug::print(Debug::Level::warning, REMOVED("TcpConnection::doneRead(): "), ec.message().c_str());
+                // reset & close (a TLS stream that failed mid-record can't be used again):
                 getSock(*stream).socket().shutdown(asio::ip::tcp::socket::shutdown_both, ec);
-                return;
+                renewStream();
+                return abandon();
             }
+
+            lap(Pool::Phase::BODY);
+
+            auto& msg = (*res)->get();
         
-            bool wantsKeepalive = res->keep_alive();
-            const auto field_keepAlive1 = res->find(PROTECTED("onnection-close"));
-            const auto field_keepAlive2 = res->find(PROTECTED("onnection-Close"));
-            wantsKeepalive = wantsKeepalive || (field_keepAlive1 == res->end());
-            wantsKeepalive = wantsKeepalive || (field_keepAlive2 == res->end());
-
-            [this]
-            {
-                const lock_guard<mutex> lock(replies_lock);
-                replies.emplace( callerId
-                               , Reply{ (int)res->result_int()
-                                      , res->body()
-                                      }
-                               );
-            }();
+            const bool wantsKeepalive = keepsAlive(msg);
+
+            const Expected answered = inflight.front();
+            inflight.pop_front();
+
+            const int callerId = answered.callerId;
+            const int status = (int)msg.result_int();
+
+            // Completion handler runs right here, otherwise park the reply for getReply():
+            string& body = msg.body();
+            if (answered.done(callerId, status, body.data(), (int)body.size()))
+            {
+                bodies.release(std::move(body));
+            }
+            else if (replies.insert(callerId, status, std::move(body)) == false)
+            {
+                Debug::print(Debug::Level::warning, REMOVED("TcpConnection::doneRead(): reply store full "), callerId);
+            }
+
+            afterResponse(wantsKeepalive);
+        }
+
+        // HTTP/1.1 unless "Connection: close", HTTP/1.0 only with "Connection: keep-alive":
+        static bool keepsAlive(const auto& msg)
+        {
+            return msg.keep_alive();
+        }
+
+        void readStreamHeader()
+        {
+            if (chunk == nullptr)
+                chunk = std::make_unique<char[]>(chunkSize);
+            
+            res->reset(); // Shares 'arena'
+            streamRes->reset();
+            arena->rewind();
+            streamRes->emplace( std::piecewise_construct
+                              , std::make_tuple()
+                              , std::make_tuple(ArenaAllocator<char>(arena.get()))
+                              );
+            // Unbounded, memory stays at 'chunkSize' (not boost::none, older beast compares against it):
+            (*streamRes)->body_limit(std::numeric_limits<std::uint64_t>::max());
+            if (inflight.front().head)
+                (*streamRes)->skip(true);
+
+            beast::http::async_read_header(*stream, buffer, **streamRes, beast::bind_front_handler(&TcpConnection::doneStreamRead, this));
+        }
+
+        void readStreamChunk()
+        {
+            auto& body = (*streamRes)->get().body();
+            body.data = chunk.get();
+            body.size = chunkSize;
+            
+            // Idle timeout per chunk rather than for the whole transfer:
+            getSock(*stream).expires_after(std::chrono::seconds(30));
+            
+            beast::http::async_read(*stream, buffer, **streamRes, beast::bind_front_handler(&TcpConnection::doneStreamRead, this));
+        }
+
+        void doneStreamRead(beast::error_code ec, size_t bytes_transferred)
+        {
+            boost::ignore_unused(bytes_transferred);
+
+            if (ec == beast::http::error::need_buffer)
+                ec = {};
+            
+            if (ec)
+            {
+                Debug::print(Debug::Level::warning, REMOVED("TcpConnection::doneStreamRead(): "), ec.message().c_str());
+                // reset & close (a TLS stream that failed mid-record can't be used again):
+                getSock(*stream).socket().shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+                renewStream();
+                return abandon();
+            }
+
+            auto& msg = (*streamRes)->get();
+            const Expected& current = inflight.front();
+            const int status = (int)msg.result_int();
+
+            // Header only on the first round, body.data is still unset then
+            // (afterwards the parser has advanced it past what it wrote):
+            if (msg.body().data != nullptr)
+            {
+                if (const size_t got = chunkSize - msg.body().size; got > 0)
+                    current.done.sink(current.done.user, current.callerId, status, chunk.get(), (int)got, false);
+            }
+            else
+            {
+                lap(Pool::Phase::FIRST_BYTE);
+            }
+
+            if ((*streamRes)->is_done() == false)
+                return readStreamChunk();
+
+            lap(Pool::Phase::BODY);
+
+            const bool wantsKeepalive = keepsAlive(msg);
+            
+            const Expected answered = current;
+            inflight.pop_front();
+            answered.done(answered.callerId, status, nullptr, 0);
+
+            afterResponse(wantsKeepalive);
+        }
+
+        void afterResponse(const bool wantsKeepalive)
+        {
+            // Further pipelined responses are already on their way (or buffered):
+            if (inflight.empty() == false && wantsKeepalive)
+                return readResponse();
 
             buffer.clear();
+
+            totalConsecutiveReads = 0;
+
+            std::unique_lock<mutex> lock(*pendingLock);
+
+            // The server closed before answering the whole pipeline. GET/HEAD are
+            // safe to send again, first thing on the new connection:
+            if (inflight.empty() == false)
+            {
+                Debug::print(Debug::Level::warning, REMOVED("TcpConnection::afterResponse(): pipeline cut short, resending "), (int)inflight.size());
+                pending.insert( pending.begin()
+                              , std::make_move_iterator(pipelined.end() - (std::ptrdiff_t)inflight.size())
+                              , std::make_move_iterator(pipelined.end())
+                              );
+                inflight.clear();
+            }
+            pipelined.clear();
+
+            if (wantsKeepalive && pipelineDepth > 1 && pending.size() > 1 && isPipelinable(pending.front().method))
+            {
+                while ((int)pipelined.size() < pipelineDepth && pending.empty() == false && isPipelinable(pending.front().method))
+                {
+                    pipelined.push_back(std::move(pending.front()));
+                    pending.pop_front();
+                }
+                lock.unlock();
+                return nextRequestsPipelined();
+            }
+
+            if (wantsKeepalive && pending.empty() == false)
+            {
+                // Stay busy and reuse the open socket for the next queued request:
+                const Pending next = std::move(pending.front());
+                pending.pop_front();
+                lock.unlock();
+                return nextRequest(next.callerId, next.url, next.body(), next.auth, next.xApiKey, next.method, next.format, next.done, next.prepared);
+            }
+
+            // The server is closing. What's queued goes out on a new connection to the same host:
+            if (wantsKeepalive == false && pending.empty() == false)
+            {
+                const Pending next = std::move(pending.front());
+                pending.pop_front();
+                lock.unlock();
+                return reconnect(next);
+            }
+
+            // Closing with nothing queued: the slot goes back to the pool still busy.
+            // establish() takes it as it is, and from the unbind on it may already be
+            // someone else's, whose request a makeAvail() would expose:
+            if (wantsKeepalive == false)
+            {
+                disconnect();
+                return;
+            }
         
             busy->makeAvail();
 
-            totalread = 0;
-            totalConsecutiveReads = 0;
+            lock.unlock();
+
+            keepAlive(idleTimeout);
+        }
+
+        // Same strand as before: a strand of the old one would nest one level deeper every time
+        void renewStream()
+        {
+            if constexpr (this->DoSSL)
+            {
+                auto newstream = std::make_unique<Sockettype>(stream->get_executor(), this->tls.context());
+                stream.swap(newstream);
+            }
+            else
+            {
+                auto newstream = std::make_unique<Sockettype>(stream->get_executor());
+                stream.swap(newstream);
+            }
+        }
+
+        // Stays bound and busy, requests keep queueing up here meanwhile:
+        void reconnect(const Pending& next)
+        {
+            beast::error_code ec;
+            getSock(*stream).socket().shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+            renewStream();
+            closed();
+
+            const string site = userpw.empty() ? hostField : userpw + "@" + hostField;
+            if (socksProxyPort != 0)
+                establish<true>(next.callerId, site, next.url, next.body(), next.auth, next.xApiKey, next.method, next.format, socksProxyPort, next.done, false, next.prepared);
+            else
+                establish<false>(next.callerId, site, next.url, next.body(), next.auth, next.xApiKey, next.method, next.format, 0, next.done, false, next.prepared);
+        }
 
-            if (wantsKeepalive)
-                keepAlive(60);
+        beast::error_code disconnect()
+        {
+            beast::error_code ec;
+            getSock(*stream).socket().shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+    
+            renewStream();
+    
+            // Clear host once disconnected:
+            unbind();
+            return ec;
         }
 
         void keepAlive(const int timeout)
         {
             auto close = [this](boost::system::error_code ec)
                          {
-                             getSock(*stream).socket().shutdown(asio::ip::tcp::socket::shutdown_both, ec);
-    
-                             if constexpr (this->DoSSL)
-                             {
-                                 auto newstream = std::make_unique<Sockettype>(make_strand(stream->get_executor()), this->ssl_ctx);
-                                 stream.swap(newstream);
-                             }
-                             else
-                             {
-                                 auto newstream = std::make_unique<Sockettype>(make_strand(stream->get_executor()));
-                                 stream.swap(newstream);
-                             }
-    
-                             // Clear host once disconnected:
-                             hostHash->store(0, std::memory_order_relaxed);
+                             // Re-armed or cancelled by a new request:
+                             if (ec == asio::error::operation_aborted)
+                                 return;
+
+                             // Nobody may pick the socket while it goes, nor queue on it:
+                             const lock_guard<mutex> lock(*pendingLock);
+                             if (busy->isAvail_then_lock() != AtomicFlag::State::avail_but_no_more)
+                                 return;
+                             ec = disconnect(); // Stays busy, as in afterResponse()
                              
                              if (ec)
                                  Debug::print(Debug::Level::warning, REMOVED("TcpConnection::keepAlive(): "), ec.message().c_str());
@@ -494,57 +2433,440 @@ using enum Debug::Level;
 /* Connection pool                                                           */ 
 /*****************************************************************************/    
     /****************************************/
-    /*     Connection pool internal members */
+    /*                                Shard */
+    /*                                      */
+    /* One io_context and its own slots. A  */
+    /* host always maps to the same shard,  */
+    /* so its slots are only ever touched   */
+    /* from that shard's thread.            */
     /****************************************/
-    struct Pool::PoolMembers
+    struct Shard
     {
+        asio::io_context&            ioContext;
+
+        const Pool::Limits&          limits;
+
+        ReplyStore&                  replies;
+
+        BodyPool&                    bodies;
+
+        DnsCache&                    dns;
+
+        TlsClient&                   tls;
+
+        Metrics&                     metrics;
+
+        unique_ptr<SocksSpares>      spares;
+
         vector<TcpConnection<beast::tcp_stream, SSL_off>> connections;
 
         vector<TcpConnection<beast::ssl_stream<beast::tcp_stream>, SSL_on>> connectionsSSL;
 
-        mutex                        replies_lock;
-        unordered_map<int, Reply>    replies;
+        unique_ptr<HostTable>        hosts, hostsSSL;
+
+        // Keep-warm pings, one recurring task per host (index: SSL):
+        unique_ptr<Director>         director;
+        std::unordered_map<string, TimingWheel::TaskId> warmTasks[2];
+
+        // Classic mode only: callers route from their own threads while the
+        // keep-warm pings run on the io thread. Recursive, a failed request's
+        // Completion may well submit the next one:
+        unique_ptr<std::recursive_mutex> routing;
+
+        Shard(asio::io_context& ioCtx, const Pool::Limits& l, ReplyStore& r, BodyPool& b, DnsCache& d, TlsClient& t, Metrics& m, const bool ownThread)
+          : ioContext(ioCtx)
+          , limits(l)
+          , replies(r)
+          , bodies(b)
+          , dns(d)
+          , tls(t)
+          , metrics(m)
+          , spares(make_unique<SocksSpares>(ioCtx, l.socksSpares))
+          , hosts(make_unique<HostTable>())
+          , hostsSSL(make_unique<HostTable>())
+          , director(make_unique<Director>(ioCtx))
+          , routing(ownThread ? nullptr : make_unique<std::recursive_mutex>())
+        {
+            // Handlers in flight hold 'this' of their TcpConnection, so the
+            // vectors must never reallocate once the pool is running:
+            connections.reserve(limits.maxConnections);
+            connectionsSSL.reserve(limits.maxConnectionsSSL);
+            
+            for (int i=0; i<limits.connections; ++i)
+            {
+                connections.emplace_back(ioContext, replies, bodies, dns, tls, *spares, *hosts, metrics, 60, limits.pipelineDepth, limits.maxReplyBytes);
+                hosts->addFree(i);
+            }
+            for (int i=0; i<limits.connectionsSSL; ++i)
+            {
+                connectionsSSL.emplace_back(ioContext, replies, bodies, dns, tls, *spares, *hostsSSL, metrics, 60, limits.pipelineDepth, limits.maxReplyBytes);
+                hostsSSL->addFree(i);
+            }
+        }
+
+        template <bool SSL>
+        auto& slots()
+        {
+            if constexpr (SSL)
+                return connectionsSSL;
+            else
+                return connections;
+        }
+
+        template <bool SSL>
+        HostTable& table()
+        {
+            if constexpr (SSL)
+                return *hostsSSL;
+            else
+                return *hosts;
+        }
+
+        std::unique_lock<std::recursive_mutex> lock()
+        {
+            if (routing)
+                return std::unique_lock<std::recursive_mutex>(*routing);
+            return std::unique_lock<std::recursive_mutex>();
+        }
+
+        // A disconnected slot, or a new one while below the limit. -1: none
+        template <bool SSL>
+        int vacant(string_view host)
+        {
+            auto& slots = this->slots<SSL>();
+            
+            // Reuse connection:
+            if (const int slot = table<SSL>().takeFree(slots); slot >= 0)
+                return slot;
+
+            // Create new connection (capacity was reserved up front, so no reallocation):
+            const int maxConnections = SSL ? limits.maxConnectionsSSL : limits.maxConnections;
+            if ((int)slots.size() < maxConnections)
+            {
+                Debug::print(trace, REMOVED("Pool::request_internal(): New connection to: "), host.data());
+                // Surplus slots use the shorter idle timeout, so the pool shrinks back once traffic calms down:
+                slots.emplace_back(ioContext, replies, bodies, dns, tls, *spares, table<SSL>(), metrics, limits.idleSecs, limits.pipelineDepth, limits.maxReplyBytes);
+                return (int)slots.size() - 1;
+            }
+
+            return -1;
+        }
+
+        // Takes a vacant slot for 'site', nullptr: exhausted
+        template <bool SSL>
+        auto *bind(string_view site, const u64 hostHash)
+        {
+            auto& slots = this->slots<SSL>();
+            const int slot = vacant<SSL>(site.substr(site.find("@")+1));
+            if (slot < 0)
+                return (typename std::remove_reference_t<decltype(slots)>::value_type *)nullptr;
+
+            // Interned only now, taking a slot may have swept out the host:
+            HostTable& hostTable = table<SSL>();
+            hostTable.bind(slots, slot, hostTable.intern(slots, site, hostHash));
+            return &slots[slot];
+        }
+
+        // Open a connection to 'site' and park it, unless there is one already:
+        template <bool SSL>
+        void warm(const u64 hostHash, string_view site)
+        {
+            if (const u32 id = table<SSL>().find(site, hostHash); id != 0 && table<SSL>().slotsOf(slots<SSL>(), id).empty() == false)
+                return;
+
+            auto *connection = bind<SSL>(site, hostHash);
+            if (connection == nullptr)
+                return Debug::print(Debug::Level::warning, REMOVED("Pool::prewarm(): no free slot for "), string(site).c_str());
+
+            connection->template establish<false>(0, site, "", "", "", "", Pool::Method::HEAD, Pool::Format::TEXT, 0, Done{}, true);
+        }
+
+        // Idle connections to the host get a HEAD request, so neither our
+        // idle timer nor the server's ever sees them idle for long:
+        template <bool SSL>
+        void ping(const u64 hostHash, string_view site)
+        {
+            const auto locked = lock();
+
+            auto& slots = this->slots<SSL>();
+            if (const u32 id = table<SSL>().find(site, hostHash))
+            {
+                for (const int slot : table<SSL>().slotsOf(slots, id))
+                {
+                    auto& connection = slots[slot];
+                    if (connection.busy->isAvail_then_lock() != AtomicFlag::State::avail_but_no_more)
+                        continue;
+                    if (connection.hostId->load(std::memory_order_relaxed) != id)
+                        connection.busy->makeAvail(); // Closed meanwhile
+                    else
+                        connection.nextRequest(0, "/", "", "", "", Pool::Method::HEAD, Pool::Format::TEXT, Done{ Done::discard });
+                }
+            }
+
+            // Lost it anyway (server restart etc.), reconnect:
+            warm<SSL>(hostHash, site);
+        }
+
+        template <bool SSL>
+        void keepWarm(const u64 hostHash, const string& site)
+        {
+            SharedPtr<std::function<void()>> tick(std::make_shared<std::function<void()>>([this, hostHash, site] { ping<SSL>(hostHash, site); }));
+            warmTasks[SSL][site] = director->submitRecurring(limits.keepWarmSecs*1000, tick);
+        }
+
+        template <bool SSL>
+        void prewarm(const u64 hostHash, const string& site, const bool keepWarming)
+        {
+            const auto locked = lock();
+
+            auto& tasks = warmTasks[SSL];
+            if (const auto it = tasks.find(site); it != tasks.end() && keepWarming == false)
+            {
+                director->cancelTask(it->second);
+                tasks.erase(it);
+            }
+            else if (it == tasks.end() && keepWarming)
+            {
+                keepWarm<SSL>(hostHash, site);
+            }
+
+            warm<SSL>(hostHash, site);
+        }
+
+        // Batches pick SSL per request:
+        void routeAny( const bool ssl
+                     , const u64 hostHash
+                     , const int callerId
+                     , string_view site
+                     , string_view url
+                     , string_view data
+                     , string_view auth
+                     , string_view xApiKey
+                     , const Pool::Method method
+                     , const Pool::Format format
+                     , const Done done
+                     )
+        {
+            if (ssl)
+                return route<true, false>(hostHash, callerId, site, url, data, auth, xApiKey, method, format, 0, done);
+            route<false, false>(hostHash, callerId, site, url, data, auth, xApiKey, method, format, 0, done);
+        }
+
+        template <bool SSL, bool ConnectSocks5>
+        void route( const u64 hostHash
+                  , const int callerId
+                  , string_view site
+                  , string_view url
+                  , string_view data
+                  , string_view auth
+                  , string_view xApiKey
+                  , const Pool::Method method
+                  , const Pool::Format format
+                  , const unsigned short socks5port
+                  , const Done done
+                  , const Pool::Prepared *endpoint = nullptr
+                  )
+        {
+            const auto locked = lock();
+
+            metrics.requests.fetch_add(1, std::memory_order_relaxed);
+
+            auto& slots = this->slots<SSL>();
+            std::string_view host = site.substr(site.find("@")+1);
+            
+            // Find if host already connected:
+            int nHostConnections = 0;
+            typename std::remove_reference_t<decltype(slots)>::value_type *leastQueued = nullptr;
+            int leastQueuedCnt = 0;
+            const u32 id = table<SSL>().find(site, hostHash);
+            if (id != 0)
+            {
+                for (const int slot : table<SSL>().slotsOf(slots, id))
+                {
+                    auto& connection = slots[slot];
+                    nHostConnections += 1;
+                    if (const int cnt = connection.queued(); leastQueued == nullptr || cnt < leastQueuedCnt)
+                    {
+                        leastQueued = &connection;
+                        leastQueuedCnt = cnt;
+                    }
+                    // host found, sending new request:
+                    if (connection.busy->isAvail_then_lock() == AtomicFlag::State::avail_but_no_more)
+                    {
+                        // Closed since find() (idle timeout, server close), just a vacant slot now:
+                        if (connection.hostId->load(std::memory_order_relaxed) != id)
+                        {
+                            connection.busy->makeAvail();
+                            continue;
+                        }
+
+                        Debug::print(trace, REMOVED("Pool::request_internal(): Host found. Sending new request "));
+                        return connection.nextRequest(callerId, url, data, auth, xApiKey, method, format, done, endpoint);
+                    }
+                }
+            }
+
+            // All connections to this host are busy, wait for one of them. false: it has closed meanwhile
+            auto enqueue = [&]
+                           {
+                               using Submit = std::remove_reference_t<decltype(*leastQueued)>::Submit;
+                               const Submit submitted = leastQueued->submit( callerId
+                                                                           , url
+                                                                           , data
+                                                                           , auth
+                                                                           , xApiKey
+                                                                           , method
+                                                                           , format
+                                                                           , done
+                                                                           , limits.maxQueued
+                                                                           , id
+                                                                           , endpoint
+                                                                           );
+                               if (submitted == Submit::full)
+                               {
+                                   Debug::print(Debug::Level::warning, REMOVED("Pool::request_internal(): connection busy, queue full "), host.data());
+                                   metrics.busyRejections.fetch_add(1, std::memory_order_relaxed);
+                                   done(callerId, 999, nullptr, 0);
+                               }
+                               return submitted != Submit::gone;
+                           };
+
+            if (nHostConnections >= limits.maxPerHost && enqueue())
+                return;
+
+            if (auto *connection = bind<SSL>(site, hostHash))
+                return connection->template establish<ConnectSocks5>(callerId, site, url, data, auth, xApiKey, method, format, socks5port, done, false, endpoint);
+            
+            if (leastQueued && enqueue())
+                return;
+            
+            Debug::print(Debug::Level::error, REMOVED("Pool::request_internal(): Exhausted"));
+            metrics.exhausted.fetch_add(1, std::memory_order_relaxed);
+            done(callerId, 999, nullptr, 0);
+        }
+    };
+
+
+    /****************************************/
+    /*     Connection pool internal members */
+    /****************************************/
+    struct Pool::PoolMembers
+    {
+        const Limits                 limits;
+
+        BodyPool                     bodies;
+
+        ReplyStore                   replies;
+
+        TlsClient                    tls;
+
+        Metrics                      metrics;
+
+        // Sharded mode only, the shards' own io_contexts and threads:
+        vector<unique_ptr<asio::io_context>> contexts;
+
+        unique_ptr<DnsCache>         dns;
+
+        vector<Shard>                shards;
+
+        vector<asio::executor_work_guard<asio::io_context::executor_type>> work;
+
+        vector<std::thread>          threads;
+
+        static Limits clamp(Limits l)
+        {
+            l.connections       = std::max(l.connections, 0);
+            l.connectionsSSL    = std::max(l.connectionsSSL, 0);
+            l.maxConnections    = std::max(l.maxConnections, l.connections);
+            l.maxConnectionsSSL = std::max(l.maxConnectionsSSL, l.connectionsSSL);
+            l.maxPerHost        = std::max(l.maxPerHost, 1);
+            l.idleSecs          = std::max(l.idleSecs, 1);
+            l.pipelineDepth     = std::max(l.pipelineDepth, 1);
+            l.replyCapacity     = std::max(l.replyCapacity, 1);
+            l.replyTtlSecs      = std::max(l.replyTtlSecs, 1);
+            l.bodyBuffers       = std::max(l.bodyBuffers, 0);
+            l.maxReplyBytes     = std::max(l.maxReplyBytes, 0);
+            l.shards            = std::clamp(l.shards, 0, 256);
+            l.dnsTtlSecs        = std::max(l.dnsTtlSecs, 0);
+            l.dnsNegativeSecs   = std::max(l.dnsNegativeSecs, 0);
+            l.socksSpares       = std::max(l.socksSpares, 0);
+            l.keepWarmSecs      = std::max(l.keepWarmSecs, 1);
+            return l;
+        }
+
+        static void pin(std::thread& thread, const int cpu)
+        {
+#ifdef _WIN32
+            if (SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << cpu) == 0)
+#else
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            if (pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) != 0)
+#endif
+                Debug::print(Debug::Level::warning, REMOVED("Pool::PoolMembers::pin(): failed for cpu "), cpu);
+        }
         
-        PoolMembers(asio::io_context& ioContext, const int max_connections, const int max_connections_ssl)
+        PoolMembers(asio::io_context& ioCtx, std::atomic_int& nCurrentConnected, const Limits& l)
+          : limits(clamp(l))
+          , bodies(limits.bodyBuffers)
+          , replies(limits.replyCapacity, limits.replyTtlSecs, bodies)
+          , metrics(nCurrentConnected)
         {
-            for (int i=0; i<max_connections; ++i)
-                connections.emplace_back(ioContext, replies_lock, replies);
-            for (int i=0; i<max_connections_ssl; ++i)
-                connectionsSSL.emplace_back(ioContext, replies_lock, replies);
+            // Hint 1: only ever run from one thread, asio can skip its locking:
+            for (int i=0; i<limits.shards; ++i)
+                contexts.push_back(make_unique<asio::io_context>(1));
+
+            // DNS refreshes run on the first shard, or wherever the pool runs:
+            dns = make_unique<DnsCache>(contexts.empty() ? ioCtx : *contexts.front(), limits.dnsTtlSecs, limits.dnsNegativeSecs);
+            
+            if (limits.shards == 0)
+            {
+                // Classic mode, whoever runs the global io_context drives the pool:
+                shards.emplace_back(ioCtx, limits, replies, bodies, *dns, tls, metrics, false);
+                return;
+            }
+
+            // Shards hold on to each other's address through posted handlers:
+            shards.reserve(limits.shards);
+            const int nCpus = (int)std::max(std::thread::hardware_concurrency(), 1u);
+            for (int i=0; i<limits.shards; ++i)
+            {
+                shards.emplace_back(*contexts[i], limits, replies, bodies, *dns, tls, metrics, true);
+                work.push_back(asio::make_work_guard(*contexts[i]));
+                threads.emplace_back([ctx = contexts[i].get()] { ctx->run(); });
+                if (limits.pinShards)
+                    pin(threads.back(), i % nCpus);
+            }
         }
         
         PoolMembers(const PoolMembers&) = delete;
         PoolMembers& operator=(const PoolMembers&) = delete;
-    };
 
+        ~PoolMembers()
+        {
+            for (auto& shard : shards)
+                shard.director->shutdown();
+            for (auto& w : work)
+                w.reset();
+            for (auto& ctx : contexts)
+                ctx->stop();
+            for (auto& thread : threads)
+                thread.join();
+        }
 
-    /****************************************/
-    /*                           Pool impl. */
-    /****************************************/ 
-    inline bool sslSetup(beast::tcp_stream& sock, void *host)
-    {
-        boost::ignore_unused(sock, host);
-        return true;
-    }
-    
-    inline bool sslSetup(beast::ssl_stream<beast::tcp_stream>& sock, void *host)
-    {
-        // Set SNI Hostname (many hosts need this to handshake successfully)
-        if (!SSL_set_tlsext_host_name(sock.native_handle(), host))
+        Shard& shardOf(const u64 hostHash)
         {
-            beast::error_code ec{ static_cast<int>(::ERR_get_error())
-                                , boost::asio::error::get_ssl_category() 
-                                };
-            Debug::print(Debug::Level::error, REMOVED("Pool::request_internal(): "), ec.message().c_str());
-            return false;
+            return shards[hostHash % shards.size()];
         }
-    
-        return true;
-    }
-    
-    template <bool SSL, bool ConnectSocks5, typename Connection>
-    void Pool::request_internal( Connection& connections
-                               , const int callerId
+    };
+
+
+    /****************************************/
+    /*                           Pool impl. */
+    /****************************************/ 
+    template <bool SSL, bool ConnectSocks5>
+    void Pool::request_internal( const int callerId
                                , const char *userPwHost
                                , int userPwHostLen
                                , const char *url
@@ -558,82 +2880,134 @@ using enum Debug::Level;
                                , const Pool::Method method
                                , const Pool::Format format
                                , const unsigned short socks5port
+                               , Completion onDone
+                               , void *user
+                               , Sink sink
+                               , const bool borrowData
                                )
     {
+        const Done done{ onDone, user, sink, borrowData };
+
         std::string_view site{userPwHost, (unsigned)userPwHostLen};
-        std::string_view host = site.substr(site.find("@")+1);
-    
-        // Find if host already connected:
-        const u64 hostHash = simplehash(host.data(), (enc_u32)host.size());
-        for (auto& connection : connections)
-        {
-            if (connection.hostHash->load(std::memory_order_relaxed) == hostHash)
-            {
-                Debug::print(trace, REMOVED("Pool::request_internal(): Host found. Sending new request "));
-                // host found, sending new request:
-                if (connection.busy->isAvail_then_lock() == AtomicFlag::State::avail_but_no_more)
-                    return connection.nextRequest( callerId
-                                                 , string_view{url, (unsigned)urllen}
-                                                 , string_view{data, (unsigned)datalen}
-                                                 , string_view{auth, (unsigned)authlen}
-                                                 , string_view{xApiKey, (unsigned)xApiKeylen}
-                                                 , method
-                                                 , format
-                                                 );
-                else
-                    return Debug::print(Debug::Level::warning, REMOVED("Pool::request_internal(): connection busy "), host.data());
-            }
+        const u64 hostHash = simplehash(site.data(), (enc_u32)site.size());
+
+        Shard& shard = pPoolMembers->shardOf(hostHash);
+
+        if (pPoolMembers->threads.empty())
+        {
+            return shard.route<SSL, ConnectSocks5>( hostHash
+                                                  , callerId
+                                                  , site
+                                                  , string_view{url, (unsigned)urllen}
+                                                  , string_view{data, (unsigned)datalen}
+                                                  , string_view{auth, (unsigned)authlen}
+                                                  , string_view{xApiKey, (unsigned)xApiKeylen}
+                                                  , method
+                                                  , format
+                                                  , socks5port
+                                                  , done
+                                                  );
         }
-        
-        // Reuse connection:
-        for (auto& connection : connections)
+
+        // Sharded: the caller's buffers are gone by the time the shard gets to it (except a borrowed body)
+        asio::post( shard.ioContext
+                  , [&shard, hostHash, socks5port
+                    , site = string(site)
+                    , p = Pending{ callerId
+                                 , string(url, urllen)
+                                 , borrowData ? string() : string(data, datalen)
+                                 , string(auth, authlen)
+                                 , string(xApiKey, xApiKeylen)
+                                 , method
+                                 , format
+                                 , done
+                                 , borrowData ? string_view{data, (unsigned)datalen} : string_view()
+                                 }
+                    ]
+                    {
+                        shard.route<SSL, ConnectSocks5>(hostHash, p.callerId, site, p.url, p.body(), p.auth, p.xApiKey, p.method, p.format, socks5port, p.done);
+                    }
+                  );
+    }
+
+    template <bool SSL>
+    void Pool::requestPrepared_internal( const Prepared& endpoint
+                                       , const int callerId
+                                       , const char *url
+                                       , int urllen
+                                       , const char *data
+                                       , int datalen
+                                       , Completion onDone
+                                       , void *user
+                                       )
+    {
+        const Done done{ onDone, user, nullptr, false };
+
+        // Nothing to parse or hash, that was done when 'endpoint' was made:
+        const string_view site{endpoint.site, (unsigned)endpoint.siteLen};
+        const string_view auth{endpoint.auth, (unsigned)endpoint.authLen};
+        Shard& shard = pPoolMembers->shardOf(endpoint.hostHash);
+
+        if (pPoolMembers->threads.empty())
         {
-            if (connection.hostHash->load(std::memory_order_relaxed) == 0)
-            {
-                if constexpr (SSL)
-                {
-                    if (string h(host); sslSetup(*connection.stream, h.data()) == false)
-                        return Debug::print(Debug::Level::warning, REMOVED("Pool::request_internal(): ssl setup fail"));
-                }
-                
-                return connection.template establish<ConnectSocks5>( callerId
-                                                                   , site
-                                                                   , string_view{url, (unsigned)urllen}
-                                                                   , string_view{data, (unsigned)datalen}
-                                                                   , string_view{auth, (unsigned)authlen}
-                                                                   , string_view{xApiKey, (unsigned)xApiKeylen}
-                                                                   , method
-                                                                   , format
-                                                                   , socks5port
-                                                                   );
-            }
+            return shard.route<SSL, false>( endpoint.hostHash
+                                          , callerId
+                                          , site
+                                          , string_view{url, (unsigned)urllen}
+                                          , string_view{data, (unsigned)datalen}
+                                          , auth
+                                          , {}
+                                          , endpoint.method
+                                          , endpoint.format
+                                          , 0
+                                          , done
+                                          , &endpoint
+                                          );
         }
-        
-        Debug::print(Debug::Level::error, REMOVED("Pool::request_internal(): Exhausted"));
-
-        // Create new connection:
-      /*  Debug::print(Debug::Level::trace, DBGSTR("Pool::request_internal(): New connection to: "), host.data());
-        connections.emplace_back(pPoolMembers->ioContext, pPoolMembers->replies_lock, pPoolMembers->replies);
-        auto& newConn = connections.back(); 
-        if constexpr (SSL)
-        {
-            if (string h(host); sslSetup(*newConn.stream, h.data()) == false)
-                return Debug::print(Debug::Level::warning, DBGSTR("Pool::request_internal(): ssl setup fail"));
-        }
-        newConn.template establish<ConnectSocks5>( callerId
-                                                 , site
-                                                 , string_view{url, (unsigned)urllen}
-                                                 , string_view{data, (unsigned)datalen}
-                                                 , string_view{auth, (unsigned)authlen}
-                                                 , string_view{xApiKey, (unsigned)xApiKeylen}
-                                                 , method
-                                                 , format
-                                                 , socks5port
-                                                 );*/
+
+        asio::post( shard.ioContext
+                  , [&shard, &endpoint, site, auth
+                    , p = Pending{ callerId
+                                 , string(url, urllen)
+                                 , string(data, datalen)
+                                 , {}
+                                 , {}
+                                 , endpoint.method
+                                 , endpoint.format
+                                 , done
+                                 }
+                    ]
+                    {
+                        shard.route<SSL, false>(endpoint.hostHash, p.callerId, site, p.url, p.body(), auth, {}, p.method, p.format, 0, p.done, &endpoint);
+                    }
+                  );
+    }
+       
+    void Pool::prewarm(const char *userPwHost, int userPwHostLen, const bool ssl, const bool keepWarm)
+    {
+        std::string_view site{userPwHost, (unsigned)userPwHostLen};
+        const u64 hostHash = simplehash(site.data(), (enc_u32)site.size());
+
+        Shard& shard = pPoolMembers->shardOf(hostHash);
+
+        // Always on the shard's thread, that's where the keep-warm tasks run too:
+        asio::post( shard.ioContext
+                  , [&shard, hostHash, ssl, keepWarm, site = string(site)]
+                    {
+                        if (ssl)
+                            shard.prewarm<true>(hostHash, site, keepWarm);
+                        else
+                            shard.prewarm<false>(hostHash, site, keepWarm);
+                    }
+                  );
     }
        
     Pool::Pool(void *global)
-      : pPoolMembers(new PoolMembers( ((Global *)global)->ioContext, max_concurrent_connections, max_concurrent_connections_ssl) )
+      : Pool(global, Limits())
+    {}
+
+    Pool::Pool(void *global, const Limits& limits)
+      : pPoolMembers(new PoolMembers( ((Global *)global)->ioContext, ((Global *)global)->nCurrentConnected, limits) )
     {}
 
     void Pool::request( const int callerId
@@ -651,8 +3025,7 @@ using enum Debug::Level;
                       , const Format format
                       )
     {
-        request_internal<false, false>( pPoolMembers->connections
-                                      , callerId
+        request_internal<false, false>( callerId
                                       , userPwHost
                                       , userPwHostLen
                                       , url
@@ -668,6 +3041,73 @@ using enum Debug::Level;
                                       );
     }
 
+    void Pool::request( const int callerId
+                      , const char *userPwHost
+                      , int userPwHostLen
+                      , const char *url
+                      , int urllen
+                      , const char *data
+                      , int datalen
+                      , const char *auth
+                      , int authlen
+                      , const char *xApiKey
+                      , int xApiKeylen
+                      , const Pool::Method method
+                      , const Format format
+                      , Completion onDone
+                      , void *user
+                      )
+    {
+        request_internal<false, false>( callerId
+                                      , userPwHost
+                                      , userPwHostLen
+                                      , url
+                                      , urllen
+                                      , data
+                                      , datalen
+                                      , auth
+                                      , authlen
+                                      , xApiKey
+                                      , xApiKeylen
+                                      , method
+                                      , format
+                                      , 0
+                                      , onDone
+                                      , user
+                                      );
+    }
+
+    void Pool::requestSSL( const int callerId
+                         , const char *userPwHost
+                         , int userPwHostLen
+                         , const char *url
+                         , int urllen
+                         , const char *data
+                         , int datalen
+                         , const char *auth
+                         , int authlen
+                         , const char *xApiKey
+                         , int xApiKeylen
+                         , const Pool::Method method
+                         , const Format format
+                         )
+    {
+        request_internal<true, false>( callerId
+                                     , userPwHost
+                                     , userPwHostLen
+                                     , url
+                                     , urllen
+                                     , data
+                                     , datalen
+                                     , auth
+                                     , authlen
+                                     , xApiKey
+                                     , xApiKeylen
+                                     , method
+                                     , format
+                                     );
+    }
+
     void Pool::requestSSL( const int callerId
                          , const char *userPwHost
                          , int userPwHostLen
@@ -681,10 +3121,160 @@ using enum Debug::Level;
                          , int xApiKeylen
                          , const Pool::Method method
                          , const Format format
+                         , Completion onDone
+                         , void *user
                          )
     {
-        request_internal<true, false>( pPoolMembers->connectionsSSL
-                                     , callerId
+        request_internal<true, false>( callerId
+                                     , userPwHost
+                                     , userPwHostLen
+                                     , url
+                                     , urllen
+                                     , data
+                                     , datalen
+                                     , auth
+                                     , authlen
+                                     , xApiKey
+                                     , xApiKeylen
+                                     , method
+                                     , format
+                                     , 0
+                                     , onDone
+                                     , user
+                                     );
+    }
+
+    void Pool::requestZeroCopy( const int callerId
+                              , const char *userPwHost
+                              , int userPwHostLen
+                              , const char *url
+                              , int urllen
+                              , const char *data
+                              , int datalen
+                              , const char *auth
+                              , int authlen
+                              , const char *xApiKey
+                              , int xApiKeylen
+                              , const Pool::Method method
+                              , const Format format
+                              , Completion onDone
+                              , void *user
+                              )
+    {
+        request_internal<false, false>( callerId
+                                      , userPwHost
+                                      , userPwHostLen
+                                      , url
+                                      , urllen
+                                      , data
+                                      , datalen
+                                      , auth
+                                      , authlen
+                                      , xApiKey
+                                      , xApiKeylen
+                                      , method
+                                      , format
+                                      , 0
+                                      , onDone
+                                      , user
+                                      , nullptr
+                                      , true
+                                      );
+    }
+
+    void Pool::requestZeroCopySSL( const int callerId
+                                 , const char *userPwHost
+                                 , int userPwHostLen
+                                 , const char *url
+                                 , int urllen
+                                 , const char *data
+                                 , int datalen
+                                 , const char *auth
+                                 , int authlen
+                                 , const char *xApiKey
+                                 , int xApiKeylen
+                                 , const Pool::Method method
+                                 , const Format format
+                                 , Completion onDone
+                                 , void *user
+                                 )
+    {
+        request_internal<true, false>( callerId
+                                     , userPwHost
+                                     , userPwHostLen
+                                     , url
+                                     , urllen
+                                     , data
+                                     , datalen
+                                     , auth
+                                     , authlen
+                                     , xApiKey
+                                     , xApiKeylen
+                                     , method
+                                     , format
+                                     , 0
+                                     , onDone
+                                     , user
+                                     , nullptr
+                                     , true
+                                     );
+    }
+
+    void Pool::requestStream( const int callerId
+                            , const char *userPwHost
+                            , int userPwHostLen
+                            , const char *url
+                            , int urllen
+                            , const char *data
+                            , int datalen
+                            , const char *auth
+                            , int authlen
+                            , const char *xApiKey
+                            , int xApiKeylen
+                            , const Pool::Method method
+                            , const Format format
+                            , Sink sink
+                            , void *user
+                            )
+    {
+        request_internal<false, false>( callerId
+                                      , userPwHost
+                                      , userPwHostLen
+                                      , url
+                                      , urllen
+                                      , data
+                                      , datalen
+                                      , auth
+                                      , authlen
+                                      , xApiKey
+                                      , xApiKeylen
+                                      , method
+                                      , format
+                                      , 0
+                                      , nullptr
+                                      , user
+                                      , sink
+                                      );
+    }
+
+    void Pool::requestStreamSSL( const int callerId
+                               , const char *userPwHost
+                               , int userPwHostLen
+                               , const char *url
+                               , int urllen
+                               , const char *data
+                               , int datalen
+                               , const char *auth
+                               , int authlen
+                               , const char *xApiKey
+                               , int xApiKeylen
+                               , const Pool::Method method
+                               , const Format format
+                               , Sink sink
+                               , void *user
+                               )
+    {
+        request_internal<true, false>( callerId
                                      , userPwHost
                                      , userPwHostLen
                                      , url
@@ -697,6 +3287,10 @@ using enum Debug::Level;
                                      , xApiKeylen
                                      , method
                                      , format
+                                     , 0
+                                     , nullptr
+                                     , user
+                                     , sink
                                      );
     }
 
@@ -716,8 +3310,7 @@ using enum Debug::Level;
                             , const unsigned short socks5port
                             )
     {
-        request_internal<false, true>( pPoolMembers->connections
-                                     , callerId
+        request_internal<false, true>( callerId
                                      , userPwHost
                                      , userPwHostLen
                                      , url
@@ -750,45 +3343,189 @@ using enum Debug::Level;
                                , const unsigned short socks5port
                                )
     {
-        request_internal<false, false>( pPoolMembers->connectionsSSL
-                                      , callerId
-                                      , userPwHost
-                                      , userPwHostLen
-                                      , url
-                                      , urllen
-                                      , data
-                                      , datalen
-                                      , auth
-                                      , authlen
-                                      , xApiKey
-                                      , xApiKeylen
-                                      , method
-                                      , format
-                                      , socks5port
-                                      );
+        request_internal<true, true>( callerId
+                                     , userPwHost
+                                     , userPwHostLen
+                                     , url
+                                     , urllen
+                                     , data
+                                     , datalen
+                                     , auth
+                                     , authlen
+                                     , xApiKey
+                                     , xApiKeylen
+                                     , method
+                                     , format
+                                     , socks5port
+                                     );
+    }
+
+    void Pool::requestPrepared( const Prepared& endpoint
+                              , const int callerId
+                              , const char *url
+                              , int urllen
+                              , const char *data
+                              , int datalen
+                              , Completion onDone
+                              , void *user
+                              )
+    {
+        requestPrepared_internal<false>(endpoint, callerId, url, urllen, data, datalen, onDone, user);
+    }
+
+    void Pool::requestPreparedSSL( const Prepared& endpoint
+                                 , const int callerId
+                                 , const char *url
+                                 , int urllen
+                                 , const char *data
+                                 , int datalen
+                                 , Completion onDone
+                                 , void *user
+                                 )
+    {
+        requestPrepared_internal<true>(endpoint, callerId, url, urllen, data, datalen, onDone, user);
     }
     
-    void Pool::getReply(const int callerId, void *dst, int& statusCode)
+    void Pool::requestBatch(const Request *requests, const int n)
     {
-        const lock_guard<mutex> lock(pPoolMembers->replies_lock);
+        auto view = [](const char *s, const int len) { return string_view{s, (unsigned)len}; };
 
-        if (pPoolMembers->replies.count(callerId) == 0)
+        struct Entry
         {
-            Debug::print(Debug::Level::warning, REMOVED("Pool::getReply() replies: "), pPoolMembers->replies.size());
-            statusCode = 999;
+            u64       hostHash;
+            size_t    shard;
+            int       i;
+        };
+
+        vector<Entry> order;
+        order.reserve(std::max(n, 0));
+        for (int i=0; i<n; ++i)
+        {
+            std::string_view site = view(requests[i].userPwHost, requests[i].userPwHostLen);
+            const u64 hostHash = simplehash(site.data(), (enc_u32)site.size());
+            order.push_back(Entry{ hostHash, hostHash % pPoolMembers->shards.size(), i });
+        }
+
+        // By shard, then host, keeping the caller's order among one host's requests:
+        std::stable_sort( order.begin()
+                        , order.end()
+                        , [requests](const Entry& a, const Entry& b)
+                          {
+                              if (a.shard != b.shard)
+                                  return a.shard < b.shard;
+                              if (requests[a.i].ssl != requests[b.i].ssl)
+                                  return requests[b.i].ssl;
+                              return a.hostHash < b.hostHash;
+                          }
+                        );
+
+        if (pPoolMembers->threads.empty())
+        {
+            Shard& shard = pPoolMembers->shards.front();
+            const auto locked = shard.lock();
+            for (const Entry& e : order)
+            {
+                const Request& rq = requests[e.i];
+                shard.routeAny( rq.ssl
+                              , e.hostHash
+                              , rq.callerId
+                              , view(rq.userPwHost, rq.userPwHostLen)
+                              , view(rq.url, rq.urllen)
+                              , view(rq.data, rq.datalen)
+                              , view(rq.auth, rq.authlen)
+                              , view(rq.xApiKey, rq.xApiKeylen)
+                              , rq.method
+                              , rq.format
+                              , Done{ rq.onDone, rq.user }
+                              );
+            }
             return;
         }
 
-        Reply& found = pPoolMembers->replies.at(callerId);
+        // Sharded: one post per shard rather than per request
+        struct Routed
+        {
+            u64       hostHash;
+            bool      ssl;
+            string    site;
+            Pending   p;
+        };
 
-        string& dst2 = *(string *)dst;
+        for (size_t begin=0; begin<order.size();)
+        {
+            Shard& shard = pPoolMembers->shards[order[begin].shard];
+
+            vector<Routed> batch;
+            for (; begin<order.size() && &pPoolMembers->shards[order[begin].shard] == &shard; ++begin)
+            {
+                const Request& rq = requests[order[begin].i];
+                batch.push_back(Routed{ order[begin].hostHash
+                                      , rq.ssl
+                                      , string(view(rq.userPwHost, rq.userPwHostLen))
+                                      , Pending{ rq.callerId
+                                               , string(view(rq.url, rq.urllen))
+                                               , string(view(rq.data, rq.datalen))
+                                               , string(view(rq.auth, rq.authlen))
+                                               , string(view(rq.xApiKey, rq.xApiKeylen))
+                                               , rq.method
+                                               , rq.format
+                                               , Done{ rq.onDone, rq.user }
+                                               }
+                                      }
+                               );
+            }
+
+            asio::post( shard.ioContext
+                      , [&shard, batch = std::move(batch)]
+                        {
+                            for (const Routed& b : batch)
+                                shard.routeAny(b.ssl, b.hostHash, b.p.callerId, b.site, b.p.url, b.p.body(), b.p.auth, b.p.xApiKey, b.p.method, b.p.format, b.p.done);
+                        }
+                      );
+        }
+    }
 
-        statusCode = found.http_status;
-        swap(dst2, found.reply);
+    void Pool::getReply(const int callerId, void *dst, int& statusCode)
+    {
+        string& dst2 = *(string *)dst;
 
-        pPoolMembers->replies.erase(callerId);
+        if (pPoolMembers->replies.take(callerId, dst2, statusCode) == false)
+        {
+            Debug::print(Debug::Level::warning, REMOVED("Pool::getReply(): no reply for "), callerId);
+            statusCode = 999;
+        }
+    }
+    
+    int Pool::getReplies(const int *callerIds, const int n, void *dsts, int *statusCodes)
+    {
+        return pPoolMembers->replies.take(callerIds, std::max(n, 0), (string *)dsts, statusCodes);
+    }
+    
+    void Pool::releaseBody(void *body)
+    {
+        pPoolMembers->bodies.release(std::move(*(string *)body));
     }
     
+    Pool::Stats Pool::stats(HostStats *hosts, const int maxHosts) const
+    {
+        Stats s = pPoolMembers->metrics.snapshot(hosts, hosts ? maxHosts : 0);
+        s.freshBodies = pPoolMembers->bodies.fresh.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    long long Pool::Histogram::percentileMicros(const double p) const
+    {
+        const long long rank = (long long)std::ceil(count * std::clamp(p, 0.0, 100.0) / 100.0);
+        long long seen = 0;
+        for (int i=0; i<histogramBuckets; ++i)
+        {
+            seen += buckets[i];
+            if (seen >= std::max(rank, 1LL))
+                return 1LL << (i+1);
+        }
+        return 0;
+    }
+
     Pool::~Pool()
     {
         delete pPoolMembers;
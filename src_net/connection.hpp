@@ -11,17 +11,130 @@
         enum class Method {GET,POST,PUT,DLETE,HEAD};
 
         enum class Format {TEXT,JSON};
+
+        // Invoked on the io thread (with shards: the one owning the host) once a
+        // reply is complete. 'body' is only valid during the call. statusCode
+        // is 999 if the request failed:
+        typedef void (*Completion)(void *user, const int callerId, const int statusCode, const char *body, const int bodylen);
+
+        // Streaming: called on the io thread for every piece of the body as it
+        // arrives, 'last' marks the final call (len may be 0 then):
+        typedef void (*Sink)(void *user, const int callerId, const int statusCode, const char *chunk, const int len, const bool last);
         
         static constexpr int max_concurrent_connections = 1;
         static constexpr int max_concurrent_connections_ssl = 5;
+
+        struct Limits
+        {
+            int connections       = max_concurrent_connections;     // Slots opened up front
+            int connectionsSSL    = max_concurrent_connections_ssl;
+            int maxConnections    = 16;                             // Hard bound the pool may grow to
+            int maxConnectionsSSL = 16;
+            int maxPerHost        = 4;                              // Parallel connections to one host, per user:pw
+            int idleSecs          = 10;                             // Keep-alive of slots beyond 'connections'
+            int maxQueued         = 64;                             // Pending requests per slot while its host is busy
+            int pipelineDepth     = 1;                              // >1: pipeline queued GET/HEAD requests (HTTP/1.1)
+            int replyCapacity     = 4096;                           // Unclaimed replies held for getReply()
+            int replyTtlSecs      = 120;                            // Unclaimed replies expire after this
+            int bodyBuffers       = 256;                            // Recycled reply buffers kept for reuse
+            int maxReplyBytes     = 8*1024*1024;                    // Longer reply bodies fail with 999, streamed ones are unbounded
+            int shards            = 0;                              // >0: own io_context+thread each, hosts split among them, slot limits are per shard
+            int pinShards         = 0;                              // 1: pin shard i to cpu i
+            int dnsTtlSecs        = 300;                            // Resolved endpoints are reused this long, 0: no cache
+            int dnsNegativeSecs   = 5;                              // Failed lookups are remembered this long
+            int socksSpares       = 2;                              // Warm connections per SOCKS5 proxy (and shard), greeting done
+            int keepWarmSecs      = 8;                              // Ping interval of prewarm(keepWarm) hosts, below idleSecs and the server's timeout
+        };
+
+        // One entry of requestBatch(), the arguments of request()/requestSSL():
+        struct Request
+        {
+            int           callerId      = 0;
+            const char   *userPwHost    = nullptr;
+            int           userPwHostLen = 0;
+            const char   *url           = nullptr;
+            int           urllen        = 0;
+            const char   *data          = nullptr;
+            int           datalen       = 0;
+            const char   *auth          = nullptr;
+            int           authlen       = 0;
+            const char   *xApiKey       = nullptr;
+            int           xApiKeylen    = 0;
+            Method        method        = Method::GET;
+            Format        format        = Format::TEXT;
+            bool          ssl           = false;
+            Completion    onDone        = nullptr;  // nullptr: the reply waits for getReply()/getReplies()
+            void         *user          = nullptr;
+        };
+
+        // A host worked out ahead of time, what request() would parse and hash on
+        // every call. Made by Endpoint (endpoint.hpp) at compile time. Borrowed,
+        // not copied: the struct itself and its strings must outlive the pool:
+        struct Prepared
+        {
+            unsigned long long  hostHash   = 0;         // simplehash() of 'site'
+            const char         *site       = nullptr;   // [user:pw@]host[:port], as request() takes it
+            int                 siteLen    = 0;
+            const char         *userpw     = nullptr;   // user:pw, may be empty
+            int                 userpwLen  = 0;
+            const char         *host       = nullptr;   // host[:port], the Host header
+            int                 hostLen    = 0;
+            const char         *sni        = nullptr;   // host alone: SNI and what's resolved
+            int                 sniLen     = 0;
+            const char         *port       = nullptr;   // Given or the scheme's default
+            int                 portLen    = 0;
+            const char         *auth       = nullptr;   // Authorization value if there's no user:pw
+            int                 authLen    = 0;
+            const char         *headers    = nullptr;   // Host, Connection and Authorization lines, sent with each of its requests
+            int                 headersLen = 0;
+            Method              method     = Method::GET;
+            Format              format     = Format::TEXT;
+        };
+
+        // Phases of a request, timed per host:
+        enum class Phase {DNS,CONNECT,HANDSHAKE,WRITE,FIRST_BYTE,BODY};
+
+        static constexpr int phaseCount = 6;
+        static constexpr int histogramBuckets = 32;
+
+        // buckets[i] counts latencies of [2^i, 2^(i+1)) microseconds, buckets[0] from 0:
+        struct Histogram
+        {
+            long long     count         = 0;
+            long long     sumMicros     = 0;
+            long long     buckets[histogramBuckets] = {};
+
+            // Upper bound of the bucket holding the p-th percentile (0 < p <= 100), 0: empty
+            long long percentileMicros(const double p) const;
+        };
+
+        struct HostStats
+        {
+            char          host[256]     = {};   // As given, with the port
+            Histogram     phases[phaseCount];   // Index: Phase. DNS only counts actual lookups, not cache hits
+        };
+
+        struct Stats
+        {
+            long long     requests       = 0;   // Routed to a connection
+            long long     reuses         = 0;   // Sent on a connection that was open already
+            long long     connects       = 0;   // Connections opened (TCP, or the SOCKS5 tunnel)
+            long long     reconnects     = 0;   // Of those, to the host the slot had been connected to before
+            long long     socksSpares    = 0;   // SOCKS5 tunnels started on a warm proxy connection (Limits::socksSpares)
+            long long     drops          = 0;   // Connections lost or failed to open, their requests got 999
+            long long     busyRejections = 0;   // All connections to the host busy and their queues full
+            long long     exhausted      = 0;   // No slot left for a new connection
+            long long     freshBodies    = 0;   // Reply bodies started without a recycled buffer (Limits::bodyBuffers)
+            int           connected      = 0;   // Open right now
+            int           hosts          = 0;   // Hosts with timings, may be more than were copied
+        };
         
     private:
         struct PoolMembers;
         PoolMembers *pPoolMembers;
 
-        template <bool SSL, bool ConnectSocks, typename Connection>
-        void request_internal( Connection& connection
-                             , const int callerId
+        template <bool SSL, bool ConnectSocks>
+        void request_internal( const int callerId
                              , const char *userPwHost
                              , int userPwHostLen
                              , const char *url
@@ -35,11 +148,28 @@
                              , const Method method
                              , const Format formatJson
                              , const unsigned short socks5port = 0
+                             , Completion onDone = nullptr
+                             , void *user = nullptr
+                             , Sink sink = nullptr
+                             , const bool borrowData = false
                              );
+
+        template <bool SSL>
+        void requestPrepared_internal( const Prepared& endpoint
+                                     , const int callerId
+                                     , const char *url
+                                     , int urllen
+                                     , const char *data
+                                     , int datalen
+                                     , Completion onDone
+                                     , void *user
+                                     );
         
     public:
         explicit Pool(void *global);
 
+        Pool(void *global, const Limits& limits);
+
         Pool(const Pool&) = delete;
         Pool& operator=(const Pool&) = delete;
 
@@ -58,6 +188,38 @@
                     , const Format format
                     );
 
+        void request( const int callerId
+                    , const char *userPwHost
+                    , int userPwHostLen
+                    , const char *url
+                    , int urllen
+                    , const char *data
+                    , int datalen
+                    , const char *auth
+                    , int authlen
+                    , const char *xApiKey
+                    , int xApiKeylen
+                    , const Method method
+                    , const Format format
+                    , Completion onDone
+                    , void *user
+                    );
+
+        void requestSSL( const int callerId
+                       , const char *userPwHost
+                       , int userPwHostLen
+                       , const char *url
+                       , int urllen
+                       , const char *data
+                       , int datalen
+                       , const char *auth
+                       , int authlen
+                       , const char *xApiKey
+                       , int xApiKeylen
+                       , const Method method
+                       , const Format format
+                       );
+
         void requestSSL( const int callerId
                        , const char *userPwHost
                        , int userPwHostLen
@@ -71,8 +233,81 @@
                        , int xApiKeylen
                        , const Method method
                        , const Format format
+                       , Completion onDone
+                       , void *user
                        );
 
+        // 'data' is borrowed, not copied: it is written straight from the caller's
+        // buffer, which must stay valid and unchanged until onDone has been called:
+        void requestZeroCopy( const int callerId
+                            , const char *userPwHost
+                            , int userPwHostLen
+                            , const char *url
+                            , int urllen
+                            , const char *data
+                            , int datalen
+                            , const char *auth
+                            , int authlen
+                            , const char *xApiKey
+                            , int xApiKeylen
+                            , const Method method
+                            , const Format format
+                            , Completion onDone
+                            , void *user
+                            );
+
+        void requestZeroCopySSL( const int callerId
+                               , const char *userPwHost
+                               , int userPwHostLen
+                               , const char *url
+                               , int urllen
+                               , const char *data
+                               , int datalen
+                               , const char *auth
+                               , int authlen
+                               , const char *xApiKey
+                               , int xApiKeylen
+                               , const Method method
+                               , const Format format
+                               , Completion onDone
+                               , void *user
+                               );
+
+        // No size limit and constant memory, the body only ever reaches 'sink':
+        void requestStream( const int callerId
+                          , const char *userPwHost
+                          , int userPwHostLen
+                          , const char *url
+                          , int urllen
+                          , const char *data
+                          , int datalen
+                          , const char *auth
+                          , int authlen
+                          , const char *xApiKey
+                          , int xApiKeylen
+                          , const Method method
+                          , const Format format
+                          , Sink sink
+                          , void *user
+                          );
+
+        void requestStreamSSL( const int callerId
+                             , const char *userPwHost
+                             , int userPwHostLen
+                             , const char *url
+                             , int urllen
+                             , const char *data
+                             , int datalen
+                             , const char *auth
+                             , int authlen
+                             , const char *xApiKey
+                             , int xApiKeylen
+                             , const Method method
+                             , const Format format
+                             , Sink sink
+                             , void *user
+                             );
+
         void requestSocks5( const int callerId
                           , const char *userPwHost
                           , int userPwHostLen
@@ -105,7 +340,49 @@
                              , const unsigned short socks5port
                              );
 
+        // request() to an endpoint known at build time, see Endpoint. onDone
+        // nullptr: the reply waits for getReply():
+        void requestPrepared( const Prepared& endpoint
+                            , const int callerId
+                            , const char *url
+                            , int urllen
+                            , const char *data
+                            , int datalen
+                            , Completion onDone = nullptr
+                            , void *user = nullptr
+                            );
+
+        void requestPreparedSSL( const Prepared& endpoint
+                               , const int callerId
+                               , const char *url
+                               , int urllen
+                               , const char *data
+                               , int datalen
+                               , Completion onDone = nullptr
+                               , void *user = nullptr
+                               );
+
+        // Resolve, connect and (ssl) handshake ahead of the first request, the
+        // connection is parked in a slot until then. keepWarm: idle connections
+        // to the host get a HEAD request every Limits::keepWarmSecs so they are
+        // never closed for idling; prewarm() without it stops that again:
+        void prewarm(const char *userPwHost, int userPwHostLen, const bool ssl, const bool keepWarm);
+
+        // Many requests in one call. They are put in host order and handed to
+        // each shard in one go, requests to the same host back to back:
+        void requestBatch(const Request *requests, const int n);
+
         void getReply(const int callerId, void *dst, int& statusCode);
+
+        // getReply() for 'n' callerIds at once, 'dsts' points to n strings.
+        // statusCodes[i] is 999 where there was no reply. Returns the number found:
+        int getReplies(const int *callerIds, const int n, void *dsts, int *statusCodes);
+
+        // Hand a string filled by getReply() back, its buffer is reused for a later reply:
+        void releaseBody(void *body);
+
+        // Snapshot of the counters, plus the timings of up to 'maxHosts' hosts:
+        Stats stats(HostStats *hosts = nullptr, const int maxHosts = 0) const;
         
         ~Pool();
     };
@@ -3,34 +3,127 @@
 
 #ifdef _WIN32
   #include <cstring>
+  #include <intrin.h>
   #define myMemcpy(dst, src, sz) std::memcpy(dst, src, sz) 
+  #define ENC_TARGET(isa)
 #else
+  #include <cpuid.h>
   #define myMemcpy(dst, src, sz) __builtin_memcpy(dst, src, sz)
+  #define ENC_TARGET(isa) __attribute__((target(isa)))
 #endif
 
 
+/****************************************/
+/*                         cpu features */
+/*                                      */
+/* Kernels are compiled for their own   */
+/* instruction set (ENC_TARGET) and     */
+/* picked at runtime, the binary itself */
+/* needs nothing beyond x86-64.         */
+/****************************************/
+    struct CpuFeatures
+    {
+        bool sse41      = false;
+        bool avx2       = false;
+        bool avx512vbmi = false; // With F and BW
+        bool aes        = false; // With SSE4.1
+        bool vaes256    = false; // With AES-NI and AVX2
+        bool vaes512    = false; // With AES-NI and AVX-512F
+    };
+
+    static void cpuid(const unsigned leaf, const unsigned subleaf, unsigned (&regs)[4])
+    {
+    #ifdef _WIN32
+        int r[4];
+        __cpuidex(r, (int)leaf, (int)subleaf);
+        for (int i=0; i<4; ++i)
+            regs[i] = (unsigned)r[i];
+    #else
+        if (__get_cpuid_count(leaf, subleaf, &regs[0], &regs[1], &regs[2], &regs[3]) == 0)
+            regs[0] = regs[1] = regs[2] = regs[3] = 0;
+    #endif
+    }
+
+    // Register state the OS saves on context switch:
+    static enc_u64 xgetbv0()
+    {
+    #ifdef _WIN32
+        return _xgetbv(0);
+    #else
+        enc_u32 lo, hi;
+        __asm__ ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        return ((enc_u64)hi << 32) | lo;
+    #endif
+    }
+
+    static CpuFeatures detectCpu()
+    {
+        CpuFeatures f;
+        unsigned r[4];
+        cpuid(0, 0, r);
+        const unsigned maxLeaf = r[0];
+
+        cpuid(1, 0, r);
+        f.sse41 = (r[2] >> 19) & 1;
+        f.aes   = f.sse41 && ((r[2] >> 25) & 1);
+        const bool osxsave = (r[2] >> 27) & 1;
+        const bool avx     = (r[2] >> 28) & 1;
+
+        const enc_u64 xcr0 = osxsave ? xgetbv0() : 0;
+        const bool ymm = (xcr0 & 0x06) == 0x06;
+        const bool zmm = (xcr0 & 0xe6) == 0xe6;
+
+        if (maxLeaf >= 7)
+        {
+            cpuid(7, 0, r);
+            f.avx2       = avx && ymm && ((r[1] >> 5) & 1);
+            f.avx512vbmi = zmm && ((r[1] >> 16) & 1) && ((r[1] >> 30) & 1) && ((r[2] >> 1) & 1);
+
+            const bool vaes = f.aes && ((r[2] >> 9) & 1);
+            f.vaes256 = vaes && f.avx2;
+            f.vaes512 = vaes && zmm && ((r[1] >> 16) & 1);
+        }
+        return f;
+    }
+
+    static const CpuFeatures& cpuFeatures()
+    {
+        static const CpuFeatures features = detectCpu();
+        return features;
+    }
+
+
 /****************************************/
 /*                            meow_hash */
 /*                                      */
 /* Simplified version of                */
 /* github.com/cmuratori/meow_hash       */
 /* (zlib License!)                      */
+/*                                      */
+/* Keys of 64 bytes and more run four   */
+/* lanes first: as xmm registers, two   */
+/* ymm or one zmm. simplehash_portable  */
+/* in encode.hpp is the reference.      */
 /****************************************/
-    enc_u64 simplemeow_x86_64(const char *str, enc_u32 len)
+    ENC_TARGET("sse4.1,aes")
+    static inline __m128i simplemeow_seed(const enc_u32 len)
     {
-        static const unsigned char restMask[32] =
-            { 255,255,255,255, 255,255,255,255, 255,255,255,255, 255,255,255,255,
-                0,  0,  0,  0,   0,  0,  0,  0,   0,  0,  0,  0,   0,  0,  0,  0
-            };
-            
         static const unsigned char defaultSeed[16] =
             { 178, 201, 95, 240, 40, 41, 143, 216,
               2, 209, 178, 114, 232, 4, 176, 188
             };
+        return _mm_xor_si128(_mm_cvtsi64_si128(len), _mm_loadu_si128((const __m128i *)defaultSeed));
+    }
+
+    // One lane for what's left, under 64 bytes:
+    ENC_TARGET("sse4.1,aes")
+    static inline enc_u64 simplemeow_finish(__m128i hashValue, const char *str, const enc_u32 len)
+    {
+        static const unsigned char restMask[32] =
+            { 255,255,255,255, 255,255,255,255, 255,255,255,255, 255,255,255,255,
+                0,  0,  0,  0,   0,  0,  0,  0,   0,  0,  0,  0,   0,  0,  0,  0
+            };
             
-        __m128i hashValue = _mm_cvtsi64_si128(len);
-        hashValue = _mm_xor_si128(hashValue, _mm_loadu_si128((const __m128i *)defaultSeed));
-    
         size_t chunkCount = len / 16;
         while (chunkCount--)
         {
@@ -54,131 +147,364 @@
         return _mm_extract_epi64(hashValue, 0) ^ _mm_extract_epi64(hashValue, 1);
     }
 
+    ENC_TARGET("sse4.1,aes")
+    static inline __m128i simplemeow_fold(const __m128i lane0, const __m128i lane1, const __m128i lane2, const __m128i lane3)
+    {
+        __m128i hashValue = _mm_aesdec_si128(_mm_xor_si128(lane0, lane1), _mm_setzero_si128());
+        hashValue = _mm_aesdec_si128(_mm_xor_si128(hashValue, lane2), _mm_setzero_si128());
+        return _mm_aesdec_si128(_mm_xor_si128(hashValue, lane3), _mm_setzero_si128());
+    }
+
+    ENC_TARGET("sse4.1,aes")
+    static enc_u64 simplemeow_aesni(const char *str, enc_u32 len)
+    {
+        __m128i hashValue = simplemeow_seed(len);
+        if (len >= 64)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            __m128i lane0 = hashValue;
+            __m128i lane1 = _mm_xor_si128(hashValue, _mm_set1_epi8(1));
+            __m128i lane2 = _mm_xor_si128(hashValue, _mm_set1_epi8(2));
+            __m128i lane3 = _mm_xor_si128(hashValue, _mm_set1_epi8(3));
+            for (enc_u32 n = len/64; n--; str += 64)
+            {
+                lane0 = _mm_aesdec_si128(_mm_xor_si128(lane0, _mm_loadu_si128((const __m128i *)(str +  0))), zero);
+                lane1 = _mm_aesdec_si128(_mm_xor_si128(lane1, _mm_loadu_si128((const __m128i *)(str + 16))), zero);
+                lane2 = _mm_aesdec_si128(_mm_xor_si128(lane2, _mm_loadu_si128((const __m128i *)(str + 32))), zero);
+                lane3 = _mm_aesdec_si128(_mm_xor_si128(lane3, _mm_loadu_si128((const __m128i *)(str + 48))), zero);
+            }
+            hashValue = simplemeow_fold(lane0, lane1, lane2, lane3);
+            len %= 64;
+        }
+        return simplemeow_finish(hashValue, str, len);
+    }
+
+    ENC_TARGET("sse4.1,aes,avx2,vaes")
+    static enc_u64 simplemeow_vaes256(const char *str, enc_u32 len)
+    {
+        __m128i hashValue = simplemeow_seed(len);
+        if (len >= 64)
+        {
+            const __m256i zero = _mm256_setzero_si256();
+            const __m256i seed = _mm256_broadcastsi128_si256(hashValue);
+            __m256i lanes01 = _mm256_xor_si256(seed, _mm256_setr_epi64x(0, 0, 0x0101010101010101ll, 0x0101010101010101ll));
+            __m256i lanes23 = _mm256_xor_si256(seed, _mm256_setr_epi64x(0x0202020202020202ll, 0x0202020202020202ll, 0x0303030303030303ll, 0x0303030303030303ll));
+            for (enc_u32 n = len/64; n--; str += 64)
+            {
+                lanes01 = _mm256_aesdec_epi128(_mm256_xor_si256(lanes01, _mm256_loadu_si256((const __m256i *)(str +  0))), zero);
+                lanes23 = _mm256_aesdec_epi128(_mm256_xor_si256(lanes23, _mm256_loadu_si256((const __m256i *)(str + 32))), zero);
+            }
+            hashValue = simplemeow_fold( _mm256_castsi256_si128(lanes01), _mm256_extracti128_si256(lanes01, 1)
+                                       , _mm256_castsi256_si128(lanes23), _mm256_extracti128_si256(lanes23, 1));
+            len %= 64;
+        }
+        return simplemeow_finish(hashValue, str, len);
+    }
+
+    ENC_TARGET("sse4.1,aes,avx512f,vaes")
+    static enc_u64 simplemeow_vaes512(const char *str, enc_u32 len)
+    {
+        __m128i hashValue = simplemeow_seed(len);
+        if (len >= 64)
+        {
+            const __m512i zero = _mm512_setzero_si512();
+            // maskz for the same reason as in base64encode_avx512vbmi
+            __m512i lanes = _mm512_xor_si512( _mm512_maskz_broadcast_i32x4(0xffff, hashValue)
+                                            , _mm512_setr_epi64(0, 0, 0x0101010101010101ll, 0x0101010101010101ll, 0x0202020202020202ll, 0x0202020202020202ll, 0x0303030303030303ll, 0x0303030303030303ll));
+            for (enc_u32 n = len/64; n--; str += 64)
+                lanes = _mm512_aesdec_epi128(_mm512_xor_si512(lanes, _mm512_loadu_si512((const void *)str)), zero);
+            hashValue = simplemeow_fold( _mm512_maskz_extracti32x4_epi32(0xff, lanes, 0), _mm512_maskz_extracti32x4_epi32(0xff, lanes, 1)
+                                       , _mm512_maskz_extracti32x4_epi32(0xff, lanes, 2), _mm512_maskz_extracti32x4_epi32(0xff, lanes, 3));
+            len %= 64;
+        }
+        return simplemeow_finish(hashValue, str, len);
+    }
+
+    static enc_u64 simplemeow_portable(const char *str, enc_u32 len)
+    {
+        return simplehash_portable(str, len);
+    }
+
     enc_u64 simplehash(const char *str, enc_u32 len)
     {
-        return simplemeow_x86_64(str, len);
+        using Kernel = enc_u64 (*)(const char *, enc_u32);
+        static const Kernel kernel = []() -> Kernel
+                                     {
+                                         const CpuFeatures& cpu = cpuFeatures();
+                                         if (cpu.vaes512) return simplemeow_vaes512;
+                                         if (cpu.vaes256) return simplemeow_vaes256;
+                                         if (cpu.aes)     return simplemeow_aesni;
+                                         return simplemeow_portable;
+                                     }();
+        return kernel(str, len);
     }
 
 
 /****************************************/
 /*                        base64 encode */
 /****************************************/ 
-    constexpr void base64encode_impl(char *dst, const char *src, int szSrc)
+    // 12 bytes from the low 12 of a lane to 16 sextets, one per byte (Mula/Lemire):
+    ENC_TARGET("sse4.1")
+    static inline __m128i base64encode_sextets_sse41(const __m128i in)
     {
-        constexpr char base64alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-    
-        constexpr char pad = '=';
-    
-        int dstIdx=0, i=0;
-        for (; (i+2) < szSrc; i+=3)
+        const __m128i bytes = _mm_shuffle_epi8(in, _mm_set_epi8(10,11,9,10, 7,8,6,7, 4,5,3,4, 1,2,0,1));
+        const __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(bytes, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+        const __m128i t1 = _mm_mullo_epi16(_mm_and_si128(bytes, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+        return _mm_or_si128(t0, t1);
+    }
+
+    // Sextet to ascii by adding the offset of its range: A-Z, a-z, 0-9, '+', '/'
+    ENC_TARGET("sse4.1")
+    static inline __m128i base64encode_ascii_sse41(const __m128i sextets)
+    {
+        const __m128i offsets = _mm_setr_epi8('a'-26, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '+'-62, '/'-63, 'A', 0, 0);
+        __m128i range = _mm_subs_epu8(sextets, _mm_set1_epi8(51));
+        range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), sextets), _mm_set1_epi8(13)));
+        return _mm_add_epi8(sextets, _mm_shuffle_epi8(offsets, range));
+    }
+
+    ENC_TARGET("avx2")
+    static inline __m256i base64encode_ascii_avx2(const __m256i sextets)
+    {
+        const __m256i offsets = _mm256_setr_epi8('a'-26, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '+'-62, '/'-63, 'A', 0, 0,
+                                                 'a'-26, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '+'-62, '/'-63, 'A', 0, 0);
+        __m256i range = _mm256_subs_epu8(sextets, _mm256_set1_epi8(51));
+        range = _mm256_or_si256(range, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), sextets), _mm256_set1_epi8(13)));
+        return _mm256_add_epi8(sextets, _mm256_shuffle_epi8(offsets, range));
+    }
+
+    static void base64encode_scalar(char *dst, const char *src, int szSrc)
+    {
+        base64encode_impl(dst, src, szSrc);
+    }
+
+    // Each kernel does what it can in its own width and hands the rest to the next narrower one:
+    ENC_TARGET("sse4.1")
+    static void base64encode_sse41(char *dst, const char *src, int szSrc)
+    {
+        int i=0, o=0;
+        for (; i+16 <= szSrc; i+=12, o+=16)
         {
-            dst[dstIdx++] = base64alphabet[ (src[i]>>2) & 0x3f];                               
-            dst[dstIdx++] = base64alphabet[((src[i]  &0x03) << 4) | ((src[i+1] & 0xf0) >> 4)];
-            dst[dstIdx++] = base64alphabet[((src[i+1]&0x0f) << 2) | ((src[i+2] & 0xc0) >> 6)];
-            dst[dstIdx++] = base64alphabet[  src[i+2]&0x3f];
+            const __m128i in = _mm_loadu_si128((const __m128i *)(src + i));
+            _mm_storeu_si128((__m128i *)(dst + o), base64encode_ascii_sse41(base64encode_sextets_sse41(in)));
         }
-        if (i < szSrc)
+        base64encode_impl(dst + o, src + i, szSrc - i);
+    }
+
+    ENC_TARGET("avx2")
+    static void base64encode_avx2(char *dst, const char *src, int szSrc)
+    {
+        int i=0, o=0;
+        for (; i+28 <= szSrc; i+=24, o+=32)
         {
-            dst[dstIdx++] = base64alphabet[(src[i]>>2) & 0x3f];
-            if (i+1 == szSrc)
-            {
-                dst[dstIdx++] = base64alphabet[(src[i]&0x03) << 4]; 
-                dst[dstIdx++] = pad;                                
-            }
-            else
-            {
-                dst[dstIdx++] = base64alphabet[((src[i]  &0x03) << 4) | ((src[i+1] & 0xf0) >> 4)];
-                dst[dstIdx++] = base64alphabet[ (src[i+1]&0x0f) << 2];                            
-            }
-            dst[dstIdx] = pad;
+            const __m128i lo = base64encode_sextets_sse41(_mm_loadu_si128((const __m128i *)(src + i)));
+            const __m128i hi = base64encode_sextets_sse41(_mm_loadu_si128((const __m128i *)(src + i + 12)));
+            const __m256i sextets = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+            _mm256_storeu_si256((__m256i *)(dst + o), base64encode_ascii_avx2(sextets));
         }
+        base64encode_sse41(dst + o, src + i, szSrc - i);
+    }
+
+    // vpermb spreads 48 bytes over 16 dwords, vpmultishiftqb cuts the sextets, vpermb again looks them up.
+    // The maskz forms with all lanes set are the same instructions, without gcc's uninitialized warning.
+    ENC_TARGET("avx512f,avx512bw,avx512vbmi")
+    static void base64encode_avx512vbmi(char *dst, const char *src, int szSrc)
+    {
+        constexpr char base64alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        const __m512i alphabet = _mm512_loadu_si512((const void *)base64alphabet);
+        const __m512i spread = _mm512_setr_epi32(0x01020001, 0x04050304, 0x07080607, 0x0a0b090a, 0x0d0e0c0d, 0x10110f10, 0x13141213, 0x16171516,
+                                                 0x191a1819, 0x1c1d1b1c, 0x1f201e1f, 0x22232122, 0x25262425, 0x28292728, 0x2b2c2a2b, 0x2e2f2d2e);
+        const __m512i shifts = _mm512_set1_epi64(0x3036242a1016040all);
+
+        int i=0, o=0;
+        for (; i+48 <= szSrc; i+=48, o+=64)
+        {
+            const __m512i in = _mm512_maskz_loadu_epi8(0x0000ffffffffffffull, src + i);
+            const __m512i sextets = _mm512_maskz_multishift_epi64_epi8(~0ull, shifts, _mm512_maskz_permutexvar_epi8(~0ull, spread, in));
+            _mm512_storeu_si512((void *)(dst + o), _mm512_maskz_permutexvar_epi8(~0ull, sextets, alphabet));
+        }
+        base64encode_avx2(dst + o, src + i, szSrc - i);
     }
 
     void base64encode(char *dst, const char *src, int szSrc)
     {
-        base64encode_impl(dst, src, szSrc);
+        using Kernel = void (*)(char *, const char *, int);
+        static const Kernel kernel = []() -> Kernel
+                                     {
+                                         const CpuFeatures& cpu = cpuFeatures();
+                                         if (cpu.avx512vbmi) return base64encode_avx512vbmi;
+                                         if (cpu.avx2)       return base64encode_avx2;
+                                         if (cpu.sse41)      return base64encode_sse41;
+                                         return base64encode_scalar;
+                                     }();
+        // Short ones, like most credentials, never reach a vector loop:
+        if (szSrc < 16)
+            return base64encode_impl(dst, src, szSrc);
+        kernel(dst, src, szSrc);
     }
 
 
 /****************************************/
 /*                        base64 decode */
 /****************************************/ 
-    constexpr void base64decode_impl(char *dst, const char *src, int szSrc)
+    // Validation rides along with the translation: a byte is base64 if its high nibble is one of those its low nibble allows
+    ENC_TARGET("sse4.1")
+    static inline bool base64decode_sextets_sse41(__m128i& chars)
+    {
+        const __m128i offsets  = _mm_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+        const __m128i allowed  = _mm_setr_epi8((char)0xa8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8,
+                                               (char)0xf8, (char)0xf8, (char)0xf0, (char)0x54, (char)0x50, (char)0x50, (char)0x50, (char)0x54);
+        const __m128i highBits = _mm_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80, 0, 0, 0, 0, 0, 0, 0, 0);
+
+        const __m128i hi = _mm_and_si128(_mm_srli_epi32(chars, 4), _mm_set1_epi8(0x0f));
+        const __m128i lo = _mm_and_si128(chars, _mm_set1_epi8(0x0f));
+        const __m128i ok = _mm_and_si128(_mm_shuffle_epi8(allowed, lo), _mm_shuffle_epi8(highBits, hi));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(ok, _mm_setzero_si128())) != 0)
+            return false;
+
+        // '/' shares its high nibble with '+':
+        const __m128i offset = _mm_blendv_epi8(_mm_shuffle_epi8(offsets, hi), _mm_set1_epi8(16), _mm_cmpeq_epi8(chars, _mm_set1_epi8('/')));
+        chars = _mm_add_epi8(chars, offset);
+        return true;
+    }
+
+    // 4 sextets to 3 bytes in each dword, big endian, in the low 12 bytes of a lane:
+    ENC_TARGET("sse4.1")
+    static inline __m128i base64decode_pack_sse41(const __m128i sextets)
+    {
+        const __m128i pairs = _mm_maddubs_epi16(sextets, _mm_set1_epi32(0x01400140));
+        const __m128i quads = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+        return _mm_shuffle_epi8(quads, _mm_setr_epi8(2,1,0, 6,5,4, 10,9,8, 14,13,12, -1,-1,-1,-1));
+    }
+
+    ENC_TARGET("avx2")
+    static inline bool base64decode_sextets_avx2(__m256i& chars)
+    {
+        const __m256i offsets  = _mm256_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                                                  0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+        const __m256i allowed  = _mm256_setr_epi8((char)0xa8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8,
+                                                  (char)0xf8, (char)0xf8, (char)0xf0, (char)0x54, (char)0x50, (char)0x50, (char)0x50, (char)0x54,
+                                                  (char)0xa8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8,
+                                                  (char)0xf8, (char)0xf8, (char)0xf0, (char)0x54, (char)0x50, (char)0x50, (char)0x50, (char)0x54);
+        const __m256i highBits = _mm256_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80, 0, 0, 0, 0, 0, 0, 0, 0,
+                                                  0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80, 0, 0, 0, 0, 0, 0, 0, 0);
+
+        const __m256i hi = _mm256_and_si256(_mm256_srli_epi32(chars, 4), _mm256_set1_epi8(0x0f));
+        const __m256i lo = _mm256_and_si256(chars, _mm256_set1_epi8(0x0f));
+        const __m256i ok = _mm256_and_si256(_mm256_shuffle_epi8(allowed, lo), _mm256_shuffle_epi8(highBits, hi));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(ok, _mm256_setzero_si256())) != 0)
+            return false;
+
+        const __m256i offset = _mm256_blendv_epi8(_mm256_shuffle_epi8(offsets, hi), _mm256_set1_epi8(16), _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('/')));
+        chars = _mm256_add_epi8(chars, offset);
+        return true;
+    }
+
+    static int base64decode_scalar(char *dst, const char *src, int szSrc)
+    {
+        return base64decode_impl(dst, src, szSrc);
+    }
+
+    // The blocks stop short of the last quad, that's where the padding is. Stores are exact, no spill past the output.
+    ENC_TARGET("sse4.1")
+    static int base64decode_sse41(char *dst, const char *src, int szSrc)
     {
-        constexpr char pad = '=';
-        constexpr struct T
-        {
-            int vals[256];
-            constexpr T() : vals()
-            {
-                for (int c=0, i=0; i<256; ++i)
-                {
-                    // Table using RLE:
-                    vals[i] = ":y:zopqrstuvwx:9:;<=>?@ABCDEFGHIJKLMNOPQRST:UVWXYZ[\\]^_`abcdefghijklmn:"[c]-';';
-                    c += "*+./0123456789<=@ABCDEFGHIJKLMNOPQRSTUVWXYZ`abcdefghijklmnopqrstuvwxyz\0"[c] == i;
-                }
-            }
-            constexpr int operator[](int pos) const
-            {
-                return vals[pos];
-            }
-        } bitTable;
-    
-        if (szSrc == 0)
-            return;
         if (szSrc%4 != 0)
-            return;
-        int dstLen = (szSrc/4)*3;
-        if (src[szSrc-1] == pad)
-        {
-            dstLen -= 1;
-            if (src[szSrc-2] == pad)
-                dstLen -= 1;
-        }
-    
-        int srcBufLen = szSrc;
-        while (srcBufLen>0 && src[srcBufLen-1]==pad)
-            srcBufLen -= 1;
-        bool isValid = true;
-        for (int i=0; i < srcBufLen; ++i)
-        {
-            const char c = src[i];
-            isValid = isValid && ((c>='A' && c<='Z') || (c>='a' && c<='z') || (c>='/' && c<='9') || (c == '+'));
-        }
-        if (!isValid)
-            return;
-        
-        int dstIdx = 0;
-        int srcIdx = 0;
-        while (srcBufLen > 4)
+            return -1;
+        int i=0, o=0;
+        for (; i+16 <= szSrc-4; i+=16, o+=12)
         {
-            const int a = src[srcIdx+0], b = src[srcIdx+1], c = src[srcIdx+2], d = src[srcIdx+3];
-            dst[dstIdx] = (bitTable[a] << 2 | bitTable[b] >> 4);  dstIdx += 1;
-            dst[dstIdx] = (bitTable[b] << 4 | bitTable[c] >> 2);  dstIdx += 1;
-            dst[dstIdx] = (bitTable[c] << 6 | bitTable[d]);       dstIdx += 1;
-            srcIdx += 4;
-            srcBufLen -= 4;
+            __m128i chars = _mm_loadu_si128((const __m128i *)(src + i));
+            if (base64decode_sextets_sse41(chars) == false)
+                return -1;
+            const __m128i bytes = base64decode_pack_sse41(chars);
+            _mm_storel_epi64((__m128i *)(dst + o), bytes);
+            const int last = _mm_extract_epi32(bytes, 2);
+            myMemcpy(dst + o + 8, &last, 4);
         }
-        const int a = src[srcIdx+0], b = src[srcIdx+1], c = src[srcIdx+2], d = src[srcIdx+3];
-        if (srcBufLen > 1)
+        const int rest = base64decode_impl(dst + o, src + i, szSrc - i);
+        return rest < 0 ? -1 : o + rest;
+    }
+
+    ENC_TARGET("avx2")
+    static int base64decode_avx2(char *dst, const char *src, int szSrc)
+    {
+        if (szSrc%4 != 0)
+            return -1;
+        int i=0, o=0;
+        for (; i+32 <= szSrc-4; i+=32, o+=24)
         {
-            dst[dstIdx] = (bitTable[a] << 2 | bitTable[b] >> 4);
-            dstIdx += 1;
+            __m256i chars = _mm256_loadu_si256((const __m256i *)(src + i));
+            if (base64decode_sextets_avx2(chars) == false)
+                return -1;
+            const __m256i pairs = _mm256_maddubs_epi16(chars, _mm256_set1_epi32(0x01400140));
+            const __m256i quads = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+            const __m256i lanes = _mm256_shuffle_epi8(quads, _mm256_setr_epi8(2,1,0, 6,5,4, 10,9,8, 14,13,12, -1,-1,-1,-1,
+                                                                              2,1,0, 6,5,4, 10,9,8, 14,13,12, -1,-1,-1,-1));
+            const __m256i bytes = _mm256_permutevar8x32_epi32(lanes, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+            _mm_storeu_si128((__m128i *)(dst + o), _mm256_castsi256_si128(bytes));
+            _mm_storel_epi64((__m128i *)(dst + o + 16), _mm256_extracti128_si256(bytes, 1));
         }
-        if (srcBufLen > 2)
+        const int rest = base64decode_sse41(dst + o, src + i, szSrc - i);
+        return rest < 0 ? -1 : o + rest;
+    }
+
+    // vpermi2b looks all 128 ascii codes up at once, 0x80 marks the invalid ones:
+    ENC_TARGET("avx512f,avx512bw,avx512vbmi")
+    static int base64decode_avx512vbmi(char *dst, const char *src, int szSrc)
+    {
+        if (szSrc%4 != 0)
+            return -1;
+
+        alignas(64) static constexpr struct Tables
         {
-            dst[dstIdx] = (bitTable[b] << 4 | bitTable[c] >> 2);
-            dstIdx += 1;
-        }
-        if (srcBufLen > 3)
+            char sextets[128];
+            char gather[64];
+            constexpr Tables() : sextets(), gather()
+            {
+                constexpr char base64alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+                for (int c=0; c<128; ++c)
+                    sextets[c] = (char)0x80;
+                for (int v=0; v<64; ++v)
+                    sextets[(int)base64alphabet[v]] = (char)v;
+                for (int k=0; k<48; ++k)
+                    gather[k] = (char)(4*(k/3) + 2 - k%3);
+            }
+        } tables;
+
+        const __m512i lookupLo = _mm512_load_si512((const void *)tables.sextets);
+        const __m512i lookupHi = _mm512_load_si512((const void *)(tables.sextets + 64));
+        const __m512i gather   = _mm512_load_si512((const void *)tables.gather);
+
+        int i=0, o=0;
+        for (; i+64 <= szSrc-4; i+=64, o+=48)
         {
-            dst[dstIdx] = (bitTable[c] << 6 | bitTable[d]);
+            const __m512i chars = _mm512_loadu_si512((const void *)(src + i));
+            const __m512i sextets = _mm512_permutex2var_epi8(lookupLo, chars, lookupHi);
+            if (_mm512_movepi8_mask(_mm512_or_si512(sextets, chars)) != 0)
+                return -1;
+            const __m512i pairs = _mm512_maddubs_epi16(sextets, _mm512_set1_epi32(0x01400140));
+            const __m512i quads = _mm512_madd_epi16(pairs, _mm512_set1_epi32(0x00011000));
+            _mm512_mask_storeu_epi8(dst + o, 0x0000ffffffffffffull, _mm512_maskz_permutexvar_epi8(~0ull, gather, quads));
         }
+        const int rest = base64decode_avx2(dst + o, src + i, szSrc - i);
+        return rest < 0 ? -1 : o + rest;
     }
 
-    void base64decode(char *dst, const char *src, int szSrc)
+    int base64decode(char *dst, const char *src, int szSrc)
     {
-        base64decode_impl(dst, src, szSrc);
+        using Kernel = int (*)(char *, const char *, int);
+        static const Kernel kernel = []() -> Kernel
+                                     {
+                                         const CpuFeatures& cpu = cpuFeatures();
+                                         if (cpu.avx512vbmi) return base64decode_avx512vbmi;
+                                         if (cpu.avx2)       return base64decode_avx2;
+                                         if (cpu.sse41)      return base64decode_sse41;
+                                         return base64decode_scalar;
+                                     }();
+        if (szSrc < 20)
+            return base64decode_impl(dst, src, szSrc);
+        return kernel(dst, src, szSrc);
     }
     
 
@@ -190,7 +516,7 @@
                       char dst[szDst] = {0};
                       base64encode_impl(dst, test, srcSizeWithoutZero);
                       bool ok = true;
-                      for (int i=0; i<szDst; ++i)
+                      for (size_t i=0; i<szDst; ++i)
                           ok = ok && (dst[i]=="bG9naW46cGFzc3dvcg=="[i]);
                       return (szDst==20) && ok;
                   }()
@@ -202,8 +528,11 @@
                       const size_t srcSizeWithoutZero = sizeof(test) - 1;
                       constexpr auto szDst = base64decode_getRequiredSize(srcSizeWithoutZero);
                       char dst[szDst] = {0};
-                      //todo
-                      return true;
+                      base64decode_impl(dst, test, srcSizeWithoutZero);
+                      bool ok = true;
+                      for (size_t i=0; i<szDst; ++i)
+                          ok = ok && (dst[i]=="login:passwor\0\0"[i]);
+                      return (szDst==15) && ok;
                   }()
                  );
                  
@@ -23,9 +23,133 @@
 /****************************************/
 /*                  some hash functions */
 /****************************************/
+    // AES-NI or VAES, whatever the CPU has. Same output as simplehash_portable():
     enc_u64 simplehash(const char *str, enc_u32 len);
 
 
+/****************************************/
+/*                  simplehash portable */
+/*                                      */
+/* The reference: AESDEC with a zero    */
+/* round key in software, one inverse   */
+/* T-table. Runs where AES-NI doesn't,  */
+/* and at compile time.                 */
+/****************************************/
+    constexpr enc_u8 enc_gmul(enc_u8 a, enc_u8 b)
+    {
+        enc_u8 p = 0;
+        for (int i=0; i<8; ++i, b >>= 1)
+        {
+            if (b & 1)
+                p ^= a;
+            a = (enc_u8)((a << 1) ^ ((a & 0x80) ? 0x1b : 0));
+        }
+        return p;
+    }
+
+    constexpr enc_u32 enc_rotl(const enc_u32 x, const int n)
+    {
+        return (x << n) | (x >> (32 - n));
+    }
+
+    // InvSubBytes and InvMixColumns for a byte in row 0, rows 1..3 are rotations of it:
+    struct enc_AesDecTable
+    {
+        enc_u32 td[256];
+        constexpr enc_AesDecTable() : td()
+        {
+            enc_u8 exp[256] = {}, log[256] = {}, invSbox[256] = {};
+            enc_u8 p = 1;
+            for (int i=0; i<255; ++i, p = enc_gmul(p, 3))
+            {
+                exp[i] = p;
+                log[p] = (enc_u8)i;
+            }
+            for (int x=0; x<256; ++x)
+            {
+                const enc_u8 inv = x ? exp[(255 - log[x]) % 255] : 0;
+                enc_u8 s = 0x63 ^ inv;
+                for (int r=1; r<5; ++r)
+                    s ^= (enc_u8)((inv << r) | (inv >> (8 - r)));
+                invSbox[s] = (enc_u8)x;
+            }
+            for (int x=0; x<256; ++x)
+            {
+                const enc_u8 y = invSbox[x];
+                td[x] = enc_gmul(y, 14) | enc_u32(enc_gmul(y, 9)) << 8 | enc_u32(enc_gmul(y, 13)) << 16 | enc_u32(enc_gmul(y, 11)) << 24;
+            }
+        }
+    };
+    inline constexpr enc_AesDecTable enc_aesDecTable;
+
+    // One column per u32, little endian like the xmm register:
+    constexpr void enc_aesdec(enc_u32 (&s)[4])
+    {
+        const enc_u32 *td = enc_aesDecTable.td;
+        enc_u32 out[4] = {};
+        for (int c=0; c<4; ++c)
+        {
+            out[c] = td[s[c] & 0xff]
+                   ^ enc_rotl(td[(s[(c+3)&3] >>  8) & 0xff],  8)
+                   ^ enc_rotl(td[(s[(c+2)&3] >> 16) & 0xff], 16)
+                   ^ enc_rotl(td[ s[(c+1)&3] >> 24        ], 24);
+        }
+        for (int c=0; c<4; ++c)
+            s[c] = out[c];
+    }
+
+    // Xors up to 16 bytes in, the missing ones count as zero:
+    constexpr void enc_xorBlock(enc_u32 (&s)[4], const char *str, const int len = 16)
+    {
+        for (int i=0; i<len; ++i)
+            s[i/4] ^= enc_u32((enc_u8)str[i]) << (8*(i%4));
+    }
+
+    // Up to 63 bytes: one lane, 16 bytes per round, the rest zero padded.
+    // From 64 bytes on, four lanes over 64 byte blocks first, folded into one.
+    constexpr enc_u64 simplehash_portable(const char *str, enc_u32 len)
+    {
+        enc_u32 h[4] = { len ^ 0xf05fc9b2u, 0xd88f2928u, 0x72b2d102u, 0xbcb004e8u };
+
+        if (len >= 64)
+        {
+            enc_u32 lanes[4][4] = {};
+            for (enc_u32 k=0; k<4; ++k)
+                for (int c=0; c<4; ++c)
+                    lanes[k][c] = h[c] ^ (k * 0x01010101u);
+
+            for (enc_u32 n = len/64; n--; str += 64)
+            {
+                for (int k=0; k<4; ++k)
+                {
+                    enc_xorBlock(lanes[k], str + 16*k);
+                    enc_aesdec(lanes[k]);
+                }
+            }
+
+            for (int c=0; c<4; ++c)
+                h[c] = lanes[0][c];
+            for (int k=1; k<4; ++k)
+            {
+                for (int c=0; c<4; ++c)
+                    h[c] ^= lanes[k][c];
+                enc_aesdec(h);
+            }
+            len %= 64;
+        }
+
+        for (enc_u32 n = len/16; n--; str += 16)
+        {
+            enc_xorBlock(h, str);
+            enc_aesdec(h);
+        }
+        enc_xorBlock(h, str, (int)(len % 16));
+        enc_aesdec(h);
+
+        return (h[0] ^ h[2]) | enc_u64(h[1] ^ h[3]) << 32;
+    }
+
+
 /****************************************/
 /*                                fnv64 */
 /****************************************/
@@ -71,6 +195,38 @@
         return ((szSrc+2)/3)*4;
     }
 
+    // Scalar, also usable at compile time:
+    constexpr void base64encode_impl(char *dst, const char *src, int szSrc)
+    {
+        constexpr char base64alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    
+        constexpr char pad = '=';
+    
+        int dstIdx=0, i=0;
+        for (; (i+2) < szSrc; i+=3)
+        {
+            dst[dstIdx++] = base64alphabet[ (src[i]>>2) & 0x3f];                               
+            dst[dstIdx++] = base64alphabet[((src[i]  &0x03) << 4) | ((src[i+1] & 0xf0) >> 4)];
+            dst[dstIdx++] = base64alphabet[((src[i+1]&0x0f) << 2) | ((src[i+2] & 0xc0) >> 6)];
+            dst[dstIdx++] = base64alphabet[  src[i+2]&0x3f];
+        }
+        if (i < szSrc)
+        {
+            dst[dstIdx++] = base64alphabet[(src[i]>>2) & 0x3f];
+            if (i+1 == szSrc)
+            {
+                dst[dstIdx++] = base64alphabet[(src[i]&0x03) << 4]; 
+                dst[dstIdx++] = pad;                                
+            }
+            else
+            {
+                dst[dstIdx++] = base64alphabet[((src[i]  &0x03) << 4) | ((src[i+1] & 0xf0) >> 4)];
+                dst[dstIdx++] = base64alphabet[ (src[i+1]&0x0f) << 2];                            
+            }
+            dst[dstIdx] = pad;
+        }
+    }
+
     void base64encode(char *dst, const char *src, int szSrc);
     
     template <typename Int>
@@ -89,12 +245,82 @@
         return (szSrc/4)*3;
     }
 
-    void base64decode(char *dst, const char *src, int szSrc);
+    // Bytes written, -1 if src isn't base64 (then nothing is written):
+    constexpr int base64decode_impl(char *dst, const char *src, int szSrc)
+    {
+        constexpr char pad = '=';
+        constexpr struct T
+        {
+            int vals[256];
+            constexpr T() : vals()
+            {
+                for (int c=0, i=0; i<256; ++i)
+                {
+                    // Table using RLE:
+                    vals[i] = ":y:zopqrstuvwx:9:;<=>?@ABCDEFGHIJKLMNOPQRST:UVWXYZ[\\]^_`abcdefghijklmn:"[c]-';';
+                    c += "*+./0123456789<=@ABCDEFGHIJKLMNOPQRSTUVWXYZ`abcdefghijklmnopqrstuvwxyz\0"[c] == i;
+                }
+            }
+            constexpr int operator[](int pos) const
+            {
+                return vals[pos];
+            }
+        } bitTable;
+    
+        if (szSrc == 0)
+            return 0;
+        if (szSrc%4 != 0)
+            return -1;
+    
+        int srcBufLen = szSrc;
+        while (srcBufLen > szSrc-2 && src[srcBufLen-1]==pad) // At most two
+            srcBufLen -= 1;
+        bool isValid = true;
+        for (int i=0; i < srcBufLen; ++i)
+        {
+            const char c = src[i];
+            isValid = isValid && ((c>='A' && c<='Z') || (c>='a' && c<='z') || (c>='/' && c<='9') || (c == '+'));
+        }
+        if (!isValid)
+            return -1;
+        
+        int dstIdx = 0;
+        int srcIdx = 0;
+        while (srcBufLen > 4)
+        {
+            const int a = src[srcIdx+0], b = src[srcIdx+1], c = src[srcIdx+2], d = src[srcIdx+3];
+            dst[dstIdx] = (bitTable[a] << 2 | bitTable[b] >> 4);  dstIdx += 1;
+            dst[dstIdx] = (bitTable[b] << 4 | bitTable[c] >> 2);  dstIdx += 1;
+            dst[dstIdx] = (bitTable[c] << 6 | bitTable[d]);       dstIdx += 1;
+            srcIdx += 4;
+            srcBufLen -= 4;
+        }
+        const int a = src[srcIdx+0], b = src[srcIdx+1], c = src[srcIdx+2], d = src[srcIdx+3];
+        if (srcBufLen > 1)
+        {
+            dst[dstIdx] = (bitTable[a] << 2 | bitTable[b] >> 4);
+            dstIdx += 1;
+        }
+        if (srcBufLen > 2)
+        {
+            dst[dstIdx] = (bitTable[b] << 4 | bitTable[c] >> 2);
+            dstIdx += 1;
+        }
+        if (srcBufLen > 3)
+        {
+            dst[dstIdx] = (bitTable[c] << 6 | bitTable[d]);
+            dstIdx += 1;
+        }
+        return dstIdx;
+    }
+
+    // Bytes written, -1 if src isn't base64 (dst may then hold part of the output):
+    int base64decode(char *dst, const char *src, int szSrc);
 
     template <typename Int>
-    void base64decode(char *dst, const char *src, Int szSrc)
+    int base64decode(char *dst, const char *src, Int szSrc)
     {
-        base64decode(dst, src, (int)szSrc);
+        return base64decode(dst, src, (int)szSrc);
     }
 
     
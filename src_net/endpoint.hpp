@@ -0,0 +1,190 @@
+#ifndef ENDPOINT_HPP
+#define ENDPOINT_HPP
+
+// Needs connection.hpp and encode.hpp first.
+
+
+/****************************************/
+/*                          FixedString */
+/****************************************/
+    // A string literal as a template argument:
+    template <unsigned N>
+    struct FixedString
+    {
+        char chars[N] = {};
+
+        consteval FixedString(const char (&text)[N])
+        {
+            for (unsigned i = 0; i < N; ++i)
+                chars[i] = text[i];
+        }
+    };
+
+
+/****************************************/
+/*                         EndpointText */
+/****************************************/
+    // "[http[s]://][user:pw@]host[:port]" split the way TcpConnection::establish()
+    // does, and the header lines the way cacheHeaders() writes them:
+    template <unsigned N, unsigned A>
+    struct EndpointText
+    {
+        static constexpr unsigned headersCap = 64 + N + (N/3+1)*4 + A;
+
+        char site[N]              = {};  int siteLen    = 0;
+        char userpw[N]            = {};  int userpwLen  = 0;
+        char host[N]              = {};  int hostLen    = 0;
+        char sni[N]               = {};  int sniLen     = 0;
+        char port[8]              = {};  int portLen    = 0;
+        char auth[A]              = {};  int authLen    = 0;
+        char headers[headersCap]  = {};  int headersLen = 0;
+        bool ssl                  = false;
+        bool valid                = true;
+
+        consteval EndpointText(const char (&text)[N], const char (&authText)[A])
+        {
+            auto startsWith = [&](const char *prefix)
+                              {
+                                  int i = 0;
+                                  for (; prefix[i] != '\0'; ++i)
+                                      if (text[i] != prefix[i])
+                                          return 0;
+                                  return i;
+                              };
+            auto append = [&](char *dst, int& dstLen, const char *src, int srcLen)
+                          {
+                              for (int i = 0; i < srcLen; ++i)
+                                  dst[dstLen++] = src[i];
+                          };
+            auto length = [](const char *src)
+                          {
+                              int i = 0;
+                              while (src[i] != '\0')
+                                  ++i;
+                              return i;
+                          };
+
+            int pos = 0;
+            bool schemeSSL = false, hasScheme = false;
+            if (const int https = startsWith("https://"); https)
+                pos = https, schemeSSL = true, hasScheme = true;
+            else if (const int http = startsWith("http://"); http)
+                pos = http, hasScheme = true;
+
+            const int end = length(text);
+            append(site, siteLen, text+pos, end-pos);
+
+            // The first '@', a leading one is part of the host:
+            int at = -1;
+            for (int i = 0; i < siteLen && at < 0; ++i)
+                if (site[i] == '@')
+                    at = i;
+            if (at > 0)
+                append(userpw, userpwLen, site, at);
+            else
+                at = -1;
+            append(host, hostLen, site+at+1, siteLen-at-1);
+
+            int colon = -1;
+            for (int i = 0; i < hostLen; ++i)
+            {
+                valid = valid && host[i] != '/' && host[i] != ' ';
+                if (host[i] == ':')
+                    colon = i;
+            }
+            if (colon >= 0)
+            {
+                append(sni, sniLen, host, colon);
+                valid = valid && hostLen-colon-1 > 0 && hostLen-colon-1 < (int)sizeof(port);
+                for (int i = colon+1; valid && i < hostLen; ++i)
+                    valid = host[i] >= '0' && host[i] <= '9';
+                if (valid)
+                    append(port, portLen, host+colon+1, hostLen-colon-1);
+            }
+            else
+                append(sni, sniLen, host, hostLen);
+            valid = valid && sniLen > 0;
+
+            ssl = hasScheme ? schemeSSL : (portLen == 3 && port[0] == '4' && port[1] == '4' && port[2] == '3');
+            if (portLen == 0)
+                append(port, portLen, ssl ? "443" : "80", ssl ? 3 : 2);
+
+            append(auth, authLen, authText, length(authText));
+
+            const char hostLine[]       = "Host: ";
+            const char connectionLine[] = "\r\nConnection: Keep-Alive\r\n";
+            const char basicLine[]      = "Authorization: Basic ";
+            const char authLine[]       = "Authorization: ";
+            append(headers, headersLen, hostLine, sizeof(hostLine)-1);
+            append(headers, headersLen, host, hostLen);
+            append(headers, headersLen, connectionLine, sizeof(connectionLine)-1);
+            if (userpwLen > 0)
+            {
+                append(headers, headersLen, basicLine, sizeof(basicLine)-1);
+                base64encode_impl(headers+headersLen, userpw, userpwLen);
+                headersLen += base64encode_getRequiredSize(userpwLen);
+                append(headers, headersLen, "\r\n", 2);
+            }
+            else if (authLen > 0)
+            {
+                append(headers, headersLen, authLine, sizeof(authLine)-1);
+                append(headers, headersLen, auth, authLen);
+                append(headers, headersLen, "\r\n", 2);
+            }
+        }
+    };
+
+
+/****************************************/
+/*                             Endpoint */
+/****************************************/
+    // A host known at build time: parsing, the host hash and the static header
+    // lines are done by the compiler, SSL is picked by the scheme (or port 443).
+    //   using Api = Endpoint<"https://api.example.com", Pool::Method::GET, Pool::Format::JSON>;
+    //   Api::request(pool, callerId, "/v1/ticker", 10);
+    template < FixedString  Site
+             , Pool::Method M    = Pool::Method::GET
+             , Pool::Format F    = Pool::Format::TEXT
+             , FixedString  Auth = ""
+             >
+    class Endpoint
+    {
+    public:
+        static constexpr EndpointText text{Site.chars, Auth.chars};
+        static_assert(text.valid, "Endpoint: expected [http[s]://][user:pw@]host[:port]");
+
+        static constexpr bool ssl = text.ssl;
+
+        static constexpr Pool::Prepared prepared{ simplehash_portable(text.site, (enc_u32)text.siteLen)
+                                                , text.site,    text.siteLen
+                                                , text.userpw,  text.userpwLen
+                                                , text.host,    text.hostLen
+                                                , text.sni,     text.sniLen
+                                                , text.port,    text.portLen
+                                                , text.auth,    text.authLen
+                                                , text.headers, text.headersLen
+                                                , M
+                                                , F
+                                                };
+
+        static void request( Pool& pool
+                           , const int callerId
+                           , const char *url
+                           , int urllen
+                           , const char *data = ""
+                           , int datalen = 0
+                           , Pool::Completion onDone = nullptr
+                           , void *user = nullptr
+                           )
+        {
+            if constexpr (ssl)
+                pool.requestPreparedSSL(prepared, callerId, url, urllen, data, datalen, onDone, user);
+            else
+                pool.requestPrepared(prepared, callerId, url, urllen, data, datalen, onDone, user);
+        }
+    };
+
+
+#else
+  #error "double include"
+#endif // ENDPOINT_HPP
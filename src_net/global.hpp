@@ -3,7 +3,15 @@
 
 #include <boost/asio.hpp>
 #include <shared_mutex>
+#include <mutex>
 #include <atomic>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+#include <bit>
 
 
 /*****************************************************************************/
@@ -94,201 +102,369 @@
 /*                                                                  Director */ 
 /*****************************************************************************/
     /****************************************/
-    /* Doom3-style circular list            */
-    /* (but with locks)                     */
+    /* Hierarchical timing wheel            */
+    /*                                      */
+    /* 4 levels of 256 slots on 1 ms ticks: */
+    /* 256 ms, 65 s, 4.6 h, 49 days. Tasks  */
+    /* sit in pooled nodes linked into      */
+    /* their slot, far ones move down a     */
+    /* level as their slot comes up. One    */
+    /* steady_timer wakes the wheel for the */
+    /* next busy slot only.                 */
     /****************************************/
-    template <class T> class Circular;
-
-    template <class Ownertype>
-    class Node
+    class TimingWheel : public std::enable_shared_from_this<TimingWheel>
     {
     public:
-        Node(const Node&) = delete;
-        Node& operator=(const Node&) = delete;
+        using Dispatch = SharedPtr<std::function<void()>>;
+
+        // generation << 32 | node+1, the whole generation is compared on cancel:
+        using TaskId = std::uint64_t;
         
-        Node(Node&&) = default;
-        Node& operator=(Node&&) = default;
-    
-        Node()
-          : owner(nullptr)
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        static constexpr int levels = 4;
+        static constexpr int slotBits = 8;
+        static constexpr int slots = 1 << slotBits;
+        static constexpr int indexBits = 20; // At most a million nodes
+        static constexpr std::uint32_t indexMask = (1u << indexBits) - 1;
+        static constexpr std::uint32_t none = 0xffffffff;
+        static constexpr std::uint64_t idle = ~std::uint64_t(0);
+
+        struct Node
         {
-            prev = this;
-            next = this;
-        }  
-    
-        void disconnect()
+            std::uint64_t    expires = 0;    // Tick
+            std::uint32_t    period = 0;     // Ticks, 0: once
+            std::uint32_t    generation = 1; // Bumped on reuse, stale ids miss
+            std::uint32_t    prev = none;
+            std::uint32_t    next = none;
+            std::uint32_t    slot = 0;       // level*slots + slot
+            bool             armed = false;
+            Dispatch         dispatch{std::shared_ptr<std::function<void()>>()};
+        };
+
+        std::mutex                    lock;
+        boost::asio::steady_timer     timer;
+        const Clock::time_point       epoch;
+        std::uint64_t                 now = 0;         // Last tick processed
+        std::uint64_t                 armedFor = idle; // Tick the timer waits for
+        int                           count = 0;
+
+        std::vector<Node>             nodes;
+        std::vector<std::uint32_t>    freeNodes;
+        std::uint32_t                 heads[levels*slots];
+        std::uint64_t                 busy[levels][slots/64]; // Non-empty slots
+
+        // A dispatch collected by advance(), run once the lock is let go.
+        // id 0: a one-shot, released already and past cancelling:
+        struct Due
         {
-            std::unique_lock<std::shared_mutex> lock(list->lock);
-                    
-            list->head = next;
-            
-            next->prev = prev;
-            prev->next = next;
-    
-            list->cnt -= 1;
-    
-            if (list->cnt == 0)
-                list->head = nullptr;
+            TaskId      id;
+            Dispatch    dispatch;
+        };
+
+        // With 'lock' held
+        bool current(const TaskId id) const
+        {
+            const std::uint32_t i = (std::uint32_t)id - 1;
+            return i < nodes.size() && nodes[i].armed && nodes[i].generation == (std::uint32_t)(id >> 32);
         }
-        
-        Ownertype *owner;
-        Node<Ownertype> *prev;
-        Node<Ownertype> *next;
-        Circular<Ownertype> *list = nullptr;
-    };
 
+        std::uint64_t tickNow() const
+        {
+            return (std::uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - epoch).count();
+        }
 
-    template <class T>
-    class Circular
-    {
-    public:
-        Node<T> *head = nullptr;
-    
-        int cnt = 0;
-        
-        std::shared_mutex lock;
-    
-    public:
-        Circular() = default;
-        
-        Circular(const Circular&) = delete;
-        Circular& operator=(const Circular&) = delete;
+        void link(const std::uint32_t i)
+        {
+            Node& n = nodes[i];
+            const std::uint64_t delta = n.expires - now;
+            int level = 0;
+            while (level < levels-1 && delta >= (std::uint64_t(1) << (slotBits*(level+1))))
+                ++level;
+            // Beyond the top level the slot wraps early, the node is just placed again then:
+            const std::uint32_t s = (std::uint32_t)((n.expires >> (slotBits*level)) & (slots-1));
+            n.slot = level*slots + s;
+            n.prev = none;
+            n.next = heads[n.slot];
+            if (n.next != none)
+                nodes[n.next].prev = i;
+            heads[n.slot] = i;
+            busy[level][s >> 6] |= std::uint64_t(1) << (s & 63);
+        }
 
-        void insert(Node<T>& newNode)
+        void unlink(const std::uint32_t i)
         {
-            std::unique_lock<std::shared_mutex> l(lock);
-            
-            if (head)
+            Node& n = nodes[i];
+            if (n.prev != none)
+                nodes[n.prev].next = n.next;
+            else
+                heads[n.slot] = n.next;
+            if (n.next != none)
+                nodes[n.next].prev = n.prev;
+            if (heads[n.slot] == none)
             {
-                Node<T>& first = *head;
-                Node<T>& second = *head->next;
-    
-                newNode.prev = &first;
-                newNode.next = &second;
-    
-                second.prev = &newNode;
-                first.next = &newNode;
+                const std::uint32_t s = n.slot & (slots-1);
+                busy[n.slot / slots][s >> 6] &= ~(std::uint64_t(1) << (s & 63));
             }
-    
-            newNode.list = this;
-            head = &newNode;
-            cnt += 1;
         }
 
-        Node<T> *next()
+        void release(const std::uint32_t i)
         {
-            std::shared_lock<std::shared_mutex> l(lock);
-            
-            if (head)
-                head = head->next;
-            return head;
+            Node& n = nodes[i];
+            n.armed = false;
+            n.generation += 1;
+            n.dispatch = Dispatch(std::shared_ptr<std::function<void()>>());
+            freeNodes.push_back(i);
+            count -= 1;
         }
-    };
 
+        // Distance 1..slots from 'pos' to the next busy slot of 'level', 0: none.
+        // 'pos' itself counts as a full turn away:
+        int nextBusy(const int level, const int pos) const
+        {
+            for (int d=1; d<=slots;)
+            {
+                const int s = (pos + d) & (slots-1);
+                if (const std::uint64_t word = busy[level][s >> 6] >> (s & 63))
+                    return d + std::countr_zero(word);
+                d += 64 - (s & 63);
+            }
+            return 0;
+        }
 
-    /****************************************/
-    /* Task                                 */
-    /****************************************/
-    struct Task
-    {
-        SharedPtr<boost::asio::deadline_timer> timer;
+        // First tick with work: a busy level 0 slot, or a busy slot of a
+        // higher level coming up (moved down at the start of its block):
+        std::uint64_t nextEvent() const
+        {
+            std::uint64_t next = idle;
+            for (int level=0; level<levels; ++level)
+            {
+                const int shift = slotBits*level;
+                if (const int d = nextBusy(level, (int)((now >> shift) & (slots-1))))
+                    next = std::min(next, ((now >> shift) + d) << shift);
+            }
+            return next;
+        }
 
-        Node<Task> node;
-        
-        const unsigned taskid;
-
-        Task( Circular<Task>& tasks
-            , SharedPtr<boost::asio::deadline_timer> t
-            , const unsigned id
-            )
-          : timer(t)
-          , taskid(id)
+        void cascade(const int level)
         {
-            node.owner = this;
-            tasks.insert(node);
+            const std::uint32_t s = level*slots + (std::uint32_t)((now >> (slotBits*level)) & (slots-1));
+            std::uint32_t i = heads[s];
+            heads[s] = none;
+            busy[level][(s & (slots-1)) >> 6] &= ~(std::uint64_t(1) << (s & 63));
+            while (i != none)
+            {
+                const std::uint32_t next = nodes[i].next;
+                link(i);
+                i = next;
+            }
         }
-        
-        Task(Task&&) = delete;
-        Task& operator=(Task&&) = delete;
-    
-        ~Task()
+
+        // Runs the wheel up to 'target', the due dispatches are collected in 'due':
+        void advance(const std::uint64_t target, std::vector<Due>& due)
         {
-            node.disconnect();
+            while (now < target)
+            {
+                const std::uint64_t event = nextEvent();
+                if (event > target)
+                {
+                    now = target;
+                    break;
+                }
+                now = event;
+
+                for (int level=1; level<levels; ++level)
+                {
+                    if ((now & ((std::uint64_t(1) << (slotBits*level)) - 1)) != 0)
+                        break;
+                    cascade(level);
+                }
+
+                const std::uint32_t s = (std::uint32_t)(now & (slots-1));
+                std::uint32_t i = heads[s];
+                heads[s] = none;
+                busy[0][s >> 6] &= ~(std::uint64_t(1) << (s & 63));
+                while (i != none)
+                {
+                    Node& n = nodes[i];
+                    const std::uint32_t next = n.next;
+                    due.push_back(Due{ n.period ? (TaskId(n.generation) << 32) | (i + 1) : 0, n.dispatch });
+                    if (n.period)
+                    {
+                        n.expires = now + n.period;
+                        link(i);
+                    }
+                    else
+                    {
+                        release(i);
+                    }
+                    i = next;
+                }
+            }
+        }
+
+        // With 'lock' held
+        void arm()
+        {
+            if (count == 0)
+                return;
+            const std::uint64_t next = nextEvent();
+            if (next >= armedFor)
+                return;
+            armedFor = next;
+            timer.expires_at(epoch + std::chrono::milliseconds(next));
+            timer.async_wait([self = shared_from_this()](const boost::system::error_code ec)
+                             {
+                                 if (!ec)
+                                     self->fire();
+                             }
+                            );
+        }
+
+        void fire()
+        {
+            std::vector<Due> due;
+            {
+                std::lock_guard<std::mutex> l(lock);
+                armedFor = idle;
+                advance(tickNow(), due);
+                arm();
+            }
+            // Unlocked, tasks may submit or cancel tasks. A recurring one cancelled
+            // since it was collected (by an earlier task, or another thread) is skipped:
+            for (const Due& d : due)
+            {
+                if (d.id != 0)
+                {
+                    std::lock_guard<std::mutex> l(lock);
+                    if (current(d.id) == false)
+                        continue;
+                }
+                (*d.dispatch)();
+            }
+        }
+
+    public:
+        explicit TimingWheel(boost::asio::io_context& ioCtx)
+          : timer(ioCtx)
+          , epoch(Clock::now())
+        {
+            std::fill(std::begin(heads), std::end(heads), none);
+            std::fill(&busy[0][0], &busy[0][0] + levels*slots/64, 0);
+        }
+
+        TimingWheel(const TimingWheel&) = delete;
+        TimingWheel& operator=(const TimingWheel&) = delete;
+
+        // 0: no room (a million tasks pending)
+        TaskId submit(const std::uint64_t delayMs, const std::uint32_t periodMs, Dispatch dispatch)
+        {
+            std::lock_guard<std::mutex> l(lock);
+
+            const std::uint64_t t = tickNow();
+            if (count == 0)
+                now = t; // Nothing to run on the way
+
+            std::uint32_t i;
+            if (freeNodes.empty() == false)
+            {
+                i = freeNodes.back();
+                freeNodes.pop_back();
+            }
+            else if (nodes.size() < indexMask)
+            {
+                i = (std::uint32_t)nodes.size();
+                nodes.emplace_back();
+            }
+            else
+            {
+                return 0;
+            }
+
+            Node& n = nodes[i];
+            n.expires = std::max(t + delayMs, now + 1);
+            n.period = periodMs;
+            n.armed = true;
+            n.dispatch = dispatch;
+            link(i);
+            count += 1;
+
+            arm();
+            return (TaskId(n.generation) << 32) | (i + 1);
+        }
+
+        void cancel(const TaskId id)
+        {
+            std::lock_guard<std::mutex> l(lock);
+
+            if (current(id) == false)
+                return;
+            const std::uint32_t i = (std::uint32_t)id - 1;
+            unlink(i);
+            release(i);
+        }
+
+        void cancelAll()
+        {
+            std::lock_guard<std::mutex> l(lock);
+
+            for (std::uint32_t i=0; i<(std::uint32_t)nodes.size(); ++i)
+            {
+                if (nodes[i].armed)
+                {
+                    unlink(i);
+                    release(i);
+                }
+            }
+            armedFor = idle;
+            timer.cancel();
         }
     };
-    
-    
+
+
     /****************************************/
     /* Event schedule/Director              */
     /****************************************/
     class Director
     {
     private:
-        boost::asio::io_context& ioContext;
-
-        Circular<Task> circular;
-        
-        unsigned taskid = 1;
+        // Shared with the pending wait, the wheel outlives us if it has to:
+        std::shared_ptr<TimingWheel> wheel;
         
     public:
         explicit Director(boost::asio::io_context& ioCtx)
-          : ioContext(ioCtx)
+          : wheel(std::make_shared<TimingWheel>(ioCtx))
         {}
         
         Director(const Director&) = delete;
         Director& operator=(const Director&) = delete;
+
+        ~Director()
+        {
+            shutdown();
+        }
     
-        unsigned submitTask(const auto cntdwnMilliSecs, SharedPtr<std::function<void()>> dispatch)
+        TimingWheel::TaskId submitTask(const auto cntdwnMilliSecs, SharedPtr<std::function<void()>> dispatch)
         {
-            using DeadlineTimer = boost::asio::deadline_timer;
-            SharedPtr<DeadlineTimer> timer(std::make_shared<DeadlineTimer>(ioContext, boost::posix_time::milliseconds(cntdwnMilliSecs)));
-
-            SharedPtr<Task> task(std::make_shared<Task>(circular, timer, taskid));
-           
-            timer->async_wait([dispatch, timer, task](const boost::system::error_code ec)
-                              {
-                                  if (!ec)
-                                      (*dispatch)();
-                              }
-                             );
-            
-            return taskid++;
+            return wheel->submit((std::uint64_t)std::max<decltype(cntdwnMilliSecs)>(cntdwnMilliSecs, 0), 0, dispatch);
+        }
+
+        // Every 'periodMilliSecs' until cancelled, the id stays the same:
+        TimingWheel::TaskId submitRecurring(const auto periodMilliSecs, SharedPtr<std::function<void()>> dispatch)
+        {
+            const std::uint32_t period = (std::uint32_t)std::max<decltype(periodMilliSecs)>(periodMilliSecs, 1);
+            return wheel->submit(period, period, dispatch);
         }
       
-        void cancelTask(const unsigned id)
+        void cancelTask(const TimingWheel::TaskId id)
         {
-            Node<Task> *head = circular.next();
-
-            if (!head)
-                return;
-
-            Node<Task> *current = head;
-        
-            do
-            {
-                current = circular.next();
-                if (current->owner->taskid == id)
-                {
-                    current->owner->timer->cancel();
-                    return;
-                }
-            } while (current != head);
+            wheel->cancel(id);
         }
         
         void shutdown()
         {
-            Node<Task> *head = circular.next();
-
-            if (!head)
-                return;
-
-            Node<Task> *current = head;
-    
-            do
-            {
-                current = circular.next();
-                current->owner->timer->cancel();
-            } while (current != head);
+            wheel->cancelAll();
         }
     };
 